@@ -1,5 +1,7 @@
 #include "cinder/app/AppNative.h"
 #include "cinder/gl/gl.h"
+#include "cinder/gl/Texture.h"
+#include "cinder/ImageIo.h"
 #include "cinder/Rand.h"
 #include "cinder/Perlin.h"
 #include "cinder/Rect.h"
@@ -12,6 +14,10 @@
 #include "Resources.h"
 #include "ParticleCluster.h"
 #include "ParticleSystem.h"
+#include "ParticleRenderer.h"
+#include "Recording.h"
+#include "FrameExporter.h"
+#include "SimulationThread.h"
 
 #include <vector>
 #include <map>
@@ -45,7 +51,10 @@ public:
     void resize();
 
     void addNewParticleAtPosition(const Vec2f & position);
+    ParticleSpawn makeParticleSpawn(const Vec2f & position);
+    void spawnParticles(const vector<ParticleSpawn> & batch);
     void randomizeParticleProperties();
+    void recolorParticles();
     void setHighSeperation();
     void setHighNeighboring();
     void randomizeFlockingProperties();
@@ -53,17 +62,47 @@ public:
     void saveConfig();
     void loadConfig();
 
+    void updateProfileStats();
+    void toggleProfileRecording();
+    void toggleReplayRecording();
+    void toggleReplayPlayback();
+    void seekReplay();
+    void toggleFrameExport();
+    void clearParticles();
+
+    RecordedControls currentControls();
+    void setThreadedSimulation(bool threaded);
+    void updateThreaded();
+
     void shutdown();
     
-    ParticleSystem  mParticleSystem;
+    ParticleSystem      mParticleSystem;
+    ParticleRenderer    mParticleRenderer;
+    Profiler            mProfiler;
+    Recorder            mRecorder;
+    Player              mPlayer;
+    int                 mReplaySeekStep;
+    FrameExporter       mFrameExporter;
+    int                 mExportedFrames;
+    int                 mDroppedFrames;
+    vector<ParticleSpawn>   mSpawnBatch;
+
+    // Tuning edited here and handed to the system between steps
+    SimulationSettings  mSimulationSettings;
+    SimulationThread    mSimulation;
+    RecordedControls    mPushedControls;
+    SimulationSettings  mPushedSettings;
+    bool                mThreadedSimulation;
 
 #ifndef CINDER_COCOA_TOUCH
     params::InterfaceGl mParams;
     config::Config      * mConfig;
+    vector<string>      mProfileStats;
 #endif
 
     Vec2f       mForceCenter;
     Vec2f       mAttractionCenter;
+    Rectf       mBorders;
 
     Color       mParticleColor;
     string      mConfigFileName;
@@ -75,13 +114,18 @@ public:
     float   mSeparationFactor;
     float   mAlignmentFactor;
     float   mCohesionFactor;
+    float   mFlowStrength, mFlowScale, mFlowSpeed;
 
     int     mMaxParticles;
     int     mEmitRes;
     int     mNumParticles;
     int     mNumSprings;
 
+    double  mLastUpdateTime;
+
     bool    mUseFlocking;
+    bool    mUseFlowField;
+    bool    mPeriodicWorld;
     bool    mPaintWithTouchEnabled;
     bool    mAutoRandParticleProperties;
 };
@@ -125,9 +169,33 @@ void ClimaxApp::setup()
 #endif
 
     mAutoRandParticleProperties = false;
+    mUseFlowField = false;
+    mPeriodicWorld = false;
+    mFlowStrength = mParticleSystem.forceField.noiseStrength;
+    mFlowScale = mParticleSystem.forceField.noiseScale;
+    mFlowSpeed = mParticleSystem.forceField.noiseSpeed;
+    mParticleSystem.parallelStep = true;
+    mSimulationSettings = SimulationSettings(mParticleSystem);
+    mThreadedSimulation = false;
+    mReplaySeekStep = 0;
+    mExportedFrames = 0;
+    mDroppedFrames = 0;
+    mParticleSystem.profiler = & mProfiler;
+    mParticleRenderer.profiler = & mProfiler;
+    mLastUpdateTime = getElapsedSeconds();
+
+    try {
+        Surface disc(loadImage(loadResource(RES_PARTICLE_IMAGE)));
+        mParticleRenderer.spriteTexture = gl::Texture(ParticleRenderer::makeAtlas(disc));
+    } catch (Exception & e) {
+        console() << "Could not load particle sprite: " << e.what() << std::endl;
+    }
 
     mForceCenter = getWindowCenter();
     mAttractionCenter = getWindowCenter();
+    mBorders = Rectf(getWindowBounds());
+    mParticleSystem.setBorders(mBorders);
+    mParticleSystem.attractor.enabled = true;
 
 #ifndef CINDER_COCOA_TOUCH
     mConfigFileName = "config.xml";
@@ -146,6 +214,15 @@ void ClimaxApp::setup()
 
     mConfig->addParam("Max Particles", & mMaxParticles , "");
     mConfig->addParam("Emitter Resolution", & mEmitRes , "");
+    mConfig->addParam("Springs per Particle", & mSimulationSettings.springsPerParticle, "min=0 max=32");
+    mConfig->addParam("Spring Radius", & mSimulationSettings.springRadius, "min=0.f max=400.f");
+    mConfig->addParam("Spring Iterations", & mSimulationSettings.springIterations, "min=1 max=8");
+    mConfig->addParam("Parallel Simulation", & mSimulationSettings.parallelStep);
+    mConfig->addParam("Threaded Simulation", & mThreadedSimulation);
+    mConfig->addParam("Simulation Substeps", & mSimulationSettings.substeps, "min=1 max=16");
+    mConfig->addParam("Max Catch-up Steps", & mSimulationSettings.maxStepsPerUpdate, "min=1 max=16");
+    mConfig->addParam("Trail Length", & mSimulationSettings.trailLength, "min=0 max=64");
+    mConfig->addParam("Trail Opacity", & mParticleRenderer.trailAlpha, "min=0.f max=1.f step=0.05");
 
     mConfig->addParam("BPM Tempo" , & mBpm, "min=100 max=255");
     mConfig->addParam("Cluster Particle Color" , & mParticleColor);
@@ -154,6 +231,8 @@ void ClimaxApp::setup()
     mParams.addButton("Randomize Particle Color & Radius" ,
                       std::bind(& ClimaxApp::randomizeParticleProperties,
                                 this), "key=1");
+    mParams.addButton("Recolor Particles" ,
+                      std::bind(& ClimaxApp::recolorParticles, this), "key=c");
     mParams.addParam("Paint with Touch" , & mPaintWithTouchEnabled);
     mConfig->addParam("Auto-Randomize Particle Color" ,
                       & mAutoRandParticleProperties,
@@ -175,6 +254,35 @@ void ClimaxApp::setup()
     mParams.addButton("Randomize Flocking Parameters" ,
                       std::bind(& ClimaxApp::randomizeFlockingProperties,
                                 this), "key=4");
+    mConfig->addParam("Flow Field", & mUseFlowField, "key=w");
+    mConfig->addParam("Flow Strength", & mFlowStrength, "min=0.f max=5.f step=0.05");
+    mConfig->addParam("Flow Scale", & mFlowScale, "min=0.0005f max=0.05f step=0.0005");
+    mConfig->addParam("Flow Speed", & mFlowSpeed, "min=0.f max=0.05f step=0.001");
+    mConfig->addParam("Wrap Around Edges", & mPeriodicWorld);
+    mParams.addSeparator();
+
+    // p50 / p95 / p99 over the last frames, refreshed twice a second
+    mParams.addText("Profile", "label=`Profile`");
+    mProfileStats.resize(PROFILE_PHASE_COUNT + PROFILE_COUNTER_COUNT);
+    for (int i = 0; i < PROFILE_PHASE_COUNT; i++)
+        mParams.addParam(Profiler::phaseName((ProfilePhase)i), & mProfileStats[i], "", true);
+    for (int i = 0; i < PROFILE_COUNTER_COUNT; i++)
+        mParams.addParam(Profiler::counterName((ProfileCounter)i),
+                         & mProfileStats[PROFILE_PHASE_COUNT + i], "", true);
+    mParams.addButton("Record Profile CSV", bind(& ClimaxApp::toggleProfileRecording, this));
+    mParams.addSeparator();
+
+    mParams.addText("Replay", "label=`Replay`");
+    mParams.addButton("Record Replay", bind(& ClimaxApp::toggleReplayRecording, this));
+    mParams.addButton("Play Replay", bind(& ClimaxApp::toggleReplayPlayback, this));
+    mParams.addParam("Replay Step", & mReplaySeekStep, "min=0");
+    mParams.addButton("Seek Replay", bind(& ClimaxApp::seekReplay, this));
+    mParams.addSeparator();
+
+    mParams.addText("Export", "label=`Frame Export`");
+    mParams.addButton("Export Frames", bind(& ClimaxApp::toggleFrameExport, this));
+    mParams.addParam("Exported Frames", & mExportedFrames, "", true);
+    mParams.addParam("Dropped Frames", & mDroppedFrames, "", true);
     mParams.addSeparator();
 
     mParams.addText("Settings", "label=`Settings`");
@@ -193,46 +301,172 @@ void ClimaxApp::setup()
 
 void ClimaxApp::update()
 {
+    ProfileTimer timer(& mProfiler, PROFILE_UPDATE);
+
+    if (mThreadedSimulation != mSimulation.isRunning())
+        setThreadedSimulation(mThreadedSimulation);
+    if (mSimulation.isRunning()){
+        updateThreaded();
+        return;
+    }
+
     mNumParticles = mParticleSystem.particles.size();
     mNumSprings = mParticleSystem.springs.size();
 
-    for (auto it : mParticleSystem.particles){
-
-        it->separationEnabled = mUseFlocking;
-        it->separationFactor = mSeparationFactor;
-        it->alignmentEnabled = mUseFlocking;
-        it->alignmentFactor = mAlignmentFactor;
-        it->cohesionEnabled = mUseFlocking;
-        it->cohesionFactor = mCohesionFactor;
-
-        float mAttrFactor = 2.7f;
-        Vec2f attrForce = mAttractionCenter - it->position;
-        attrForce.normalize();
-        attrForce *= math<float>::max(0.f, mAttrFactor - attrForce.length());
-        it->forces += attrForce;
-        
-        float mRepulsionRadius = 200.f;
-        float mRepulsionFactor = .8f;
-        if (it->position.distance(mAttractionCenter) > mRepulsionRadius){
-            Vec2f repForce = it->position - mAttractionCenter;
-            repForce = repForce.normalized() * math<float>::max( 0.f, mRepulsionFactor * ( mRepulsionRadius - repForce.length() ) );
-            it->forces += repForce;
-        }
+    // A replay drives the system one step per frame with its own input
+    if (mPlayer.isOpen()){
+        SceneState scene;
+        scene.forceCenter = mForceCenter;
+        mPlayer.step(mParticleSystem, scene);
+        mForceCenter = scene.forceCenter;
+        mAttractionCenter = mParticleSystem.attractor.center;
+        mReplaySeekStep = (int)mParticleSystem.stepCount;
+        mFrameExporter.publish(getElapsedFrames(), mParticleSystem.particles);
+        return;
     }
-    mParticleSystem.maxParticles = mMaxParticles;
-    mParticleSystem.update();
+
+    RecordedControls controls = currentControls();
+    SceneState scene;
+    scene.forceCenter = mForceCenter;
+    mRecorder.recordFrame(mParticleSystem, scene);
+    mRecorder.recordControls(mParticleSystem, controls);
+    controls.apply(mParticleSystem, scene);
+    mSimulationSettings.apply(mParticleSystem);
+
+    double now = getElapsedSeconds();
+    mParticleSystem.update(now - mLastUpdateTime);
+    mLastUpdateTime = now;
+
+    mFrameExporter.publish(getElapsedFrames(), mParticleSystem.particles);
+    mExportedFrames = (int)mFrameExporter.framesWritten();
+    mDroppedFrames = (int)mFrameExporter.framesDropped();
+}
+
+RecordedControls ClimaxApp::currentControls()
+{
+    RecordedControls controls;
+    controls.flocking = mUseFlocking;
+    controls.separationFactor = mSeparationFactor;
+    controls.alignmentFactor = mAlignmentFactor;
+    controls.cohesionFactor = mCohesionFactor;
+    controls.attractionCenter = mAttractionCenter;
+    controls.forceCenter = mForceCenter;
+    controls.borders = mBorders;
+    controls.periodic = mPeriodicWorld;
+    controls.maxParticles = mMaxParticles;
+    controls.flowField = mUseFlowField;
+    controls.flowStrength = mFlowStrength;
+    controls.flowScale = mFlowScale;
+    controls.flowSpeed = mFlowSpeed;
+    return controls;
+}
+
+// Hands changed controls and settings to the simulation thread; anything
+// the queue has no room for goes again next frame
+void ClimaxApp::updateThreaded()
+{
+    RecordedControls controls = currentControls();
+    if (controls != mPushedControls){
+        SimulationCommand command(SIMULATION_CONTROLS);
+        command.controls = controls;
+        if (mSimulation.push(command))
+            mPushedControls = controls;
+    }
+    if (mSimulationSettings != mPushedSettings){
+        SimulationCommand command(SIMULATION_SETTINGS);
+        command.settings = mSimulationSettings;
+        if (mSimulation.push(command))
+            mPushedSettings = mSimulationSettings;
+    }
+
+    const RenderFrame & frame = mSimulation.latestFrame();
+    mNumParticles = frame.size();
+    mNumSprings = frame.springs.size();
+}
+
+// Recording, replays and frame export read the system on this thread, so
+// they stop while it runs on its own
+void ClimaxApp::setThreadedSimulation(bool threaded)
+{
+    if (! threaded){
+        mSimulation.stop();
+        mParticleSystem.profiler = & mProfiler;
+        mLastUpdateTime = getElapsedSeconds();
+        return;
+    }
+
+    mRecorder.close();
+    mPlayer.close();
+    mFrameExporter.stop();
+
+    SceneState scene;
+    scene.forceCenter = mForceCenter;
+    mPushedControls = currentControls();
+    mPushedControls.apply(mParticleSystem, scene);
+    mPushedSettings = mSimulationSettings;
+    mPushedSettings.apply(mParticleSystem);
+    mParticleSystem.profiler = NULL;
+    mSimulation.start(mParticleSystem);
+}
+
+ParticleSpawn ClimaxApp::makeParticleSpawn(const Vec2f & position)
+{
+    float radius = ci::randFloat(mParticleRadiusMin, mParticleRadiusMax);
+    float mass = radius * radius;
+    float drag = .95f;
+
+    return ParticleSpawn(position, radius, mass, drag, mTargetSeparation, mNeighboringDistance, mParticleColor);
 }
 
 void ClimaxApp::addNewParticleAtPosition(const Vec2f & position)
 {
     if (getElapsedFrames() % mEmitRes == 0) {
-        float radius = ci::randFloat(mParticleRadiusMin, mParticleRadiusMax);
-        float mass = radius * radius;
-        float drag = .95f;
+        mSpawnBatch.clear();
+        mSpawnBatch.push_back(makeParticleSpawn(position));
+        spawnParticles(mSpawnBatch);
+    }
+}
+
+void ClimaxApp::spawnParticles(const vector<ParticleSpawn> & batch)
+{
+    if (mSimulation.isRunning()){
+        SimulationCommand command(SIMULATION_SPAWN);
+        for (auto & spawn : batch){
+            command.spawn = spawn;
+            mSimulation.push(command);
+        }
+        return;
+    }
+
+    for (auto & spawn : batch)
+        mRecorder.recordSpawn(mParticleSystem, spawn);
+    mParticleSystem.addParticles(batch);
+}
+
+void ClimaxApp::clearParticles()
+{
+    if (mSimulation.isRunning()){
+        mSimulation.push(SimulationCommand(SIMULATION_CLEAR));
+        return;
+    }
+    mRecorder.recordClear(mParticleSystem);
+    mParticleSystem.clear();
+}
 
-        Particle * particle = new Particle(position, radius, mass, drag, mTargetSeparation, mNeighboringDistance, mParticleColor);
-        mParticleSystem.addParticle(particle);
+// Repaints what's being painted in a new color and carries on with it
+void ClimaxApp::recolorParticles()
+{
+    Color color(ci::randFloat(), ci::randFloat(), ci::randFloat());
+    if (mSimulation.isRunning()){
+        SimulationCommand command(SIMULATION_RECOLOR);
+        command.color = mParticleColor;
+        command.newColor = color;
+        mSimulation.push(command);
+    } else {
+        mRecorder.recordRecolor(mParticleSystem, mParticleColor, color);
+        mParticleSystem.recolor(mParticleColor, color);
     }
+    mParticleColor = color;
 }
 
 void ClimaxApp::setHighSeperation()
@@ -271,7 +505,7 @@ void ClimaxApp::touchesBegan(TouchEvent event)
             break;
         case 3:
         {
-            mParticleSystem.clear();
+            clearParticles();
         }
             break;
         default:
@@ -281,10 +515,12 @@ void ClimaxApp::touchesBegan(TouchEvent event)
 
 void ClimaxApp::touchesMoved(TouchEvent event)
 {
-    if (mPaintWithTouchEnabled)
-        for (auto touch : event.getTouches()) {
-            addNewParticleAtPosition(touch.getPos());
-        }
+    if (mPaintWithTouchEnabled && getElapsedFrames() % mEmitRes == 0) {
+        mSpawnBatch.clear();
+        for (auto touch : event.getTouches())
+            mSpawnBatch.push_back(makeParticleSpawn(touch.getPos()));
+        spawnParticles(mSpawnBatch);
+    }
 }
 
 void ClimaxApp::touchesEnded(TouchEvent event)
@@ -307,6 +543,7 @@ void ClimaxApp::resize()
 {
     mForceCenter = getWindowCenter();
     mAttractionCenter = getWindowCenter();
+    mBorders = Rectf(getWindowBounds());
 }
 
 void ClimaxApp::keyDown(KeyEvent event)
@@ -322,7 +559,7 @@ void ClimaxApp::keyDown(KeyEvent event)
 
     if (event.getChar() == ' ')
     {
-        mParticleSystem.clear();
+        clearParticles();
     }
 #ifndef CINDER_COCOA_TOUCH
     if (event.getChar() == 'S') {
@@ -339,20 +576,30 @@ void ClimaxApp::keyDown(KeyEvent event)
 
 void ClimaxApp::draw()
 {
-	gl::clear();
-    gl::enableAlphaBlending();
-    
-    // Set up line rendering
-    gl::enable(GL_LINE_SMOOTH);
-    glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
-    gl::color(ColorA::white());
-    mParticleSystem.draw();
+    {
+        ProfileTimer timer(& mProfiler, PROFILE_DRAW);
+
+        gl::clear();
+        gl::enableAlphaBlending();
+
+        // Set up line rendering
+        gl::enable(GL_LINE_SMOOTH);
+        glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
+        gl::color(ColorA::white());
+        if (mSimulation.isRunning())
+            mParticleRenderer.draw(mSimulation.latestFrame(), SimulationThread::now());
+        else
+            mParticleRenderer.draw(mParticleSystem);
+    }
+    mProfiler.endFrame();
 
 #ifndef CINDER_COCOA_TOUCH
     if (mParams.isVisible()) {
         // draw yellow circles at the active touch points
 //        gl::color(ColorA(.4f, 1.f, .8f, .7f));
 //        gl::drawStrokedCircle(mTouchesAvrgVec3, 20.0f);
+        if (getElapsedFrames() % 30 == 0)
+            updateProfileStats();
         mParams.draw();
     }
 #endif
@@ -370,10 +617,133 @@ void ClimaxApp::loadConfig()
     mConfig->load(getAppPath() / fs::path(mConfigFileName));
     console() << "Loaded configuration from: " << getAppPath() / fs::path(mConfigFileName) << std::endl;
 }
+
+void ClimaxApp::updateProfileStats()
+{
+    char text[64];
+    for (int i = 0; i < PROFILE_PHASE_COUNT; i++){
+        ProfilePhase phase = (ProfilePhase)i;
+        snprintf(text, sizeof(text), "%.2f / %.2f / %.2f ms",
+                 mProfiler.phasePercentile(phase, .5f),
+                 mProfiler.phasePercentile(phase, .95f),
+                 mProfiler.phasePercentile(phase, .99f));
+        mProfileStats[i] = text;
+    }
+    for (int i = 0; i < PROFILE_COUNTER_COUNT; i++){
+        ProfileCounter counter = (ProfileCounter)i;
+        snprintf(text, sizeof(text), "%.0f / %.0f / %.0f",
+                 mProfiler.counterPercentile(counter, .5f),
+                 mProfiler.counterPercentile(counter, .95f),
+                 mProfiler.counterPercentile(counter, .99f));
+        mProfileStats[PROFILE_PHASE_COUNT + i] = text;
+    }
+}
+
+// Snapshots plus input into replay.clmx next to the settings file, so a
+// glitch seen mid-show can be stepped up to again later
+void ClimaxApp::toggleReplayRecording()
+{
+    if (mRecorder.isOpen()){
+        mRecorder.close();
+        console() << "Stopped recording replay" << std::endl;
+        return;
+    }
+
+    if (mSimulation.isRunning()){
+        console() << "Turn Threaded Simulation off first" << std::endl;
+        return;
+    }
+
+    fs::path path = getAppPath() / fs::path("replay.clmx");
+    if (mRecorder.open(path.string()))
+        console() << "Recording replay to: " << path << std::endl;
+    else
+        console() << "Could not open " << path << std::endl;
+}
+
+void ClimaxApp::toggleReplayPlayback()
+{
+    if (mPlayer.isOpen()){
+        mPlayer.close();
+        mLastUpdateTime = getElapsedSeconds();
+        return;
+    }
+
+    if (mSimulation.isRunning()){
+        console() << "Turn Threaded Simulation off first" << std::endl;
+        return;
+    }
+
+    mRecorder.close();
+    fs::path path = getAppPath() / fs::path("replay.clmx");
+    if (! mPlayer.open(path.string())){
+        console() << "Could not play " << path << std::endl;
+        return;
+    }
+    mReplaySeekStep = (int)mPlayer.firstStep();
+    seekReplay();
+}
+
+void ClimaxApp::seekReplay()
+{
+    if (! mPlayer.isOpen())
+        return;
+
+    SceneState scene;
+    if (mPlayer.seek((uint64_t)ci::math<int>::max(mReplaySeekStep, 0), mParticleSystem, scene)){
+        mForceCenter = scene.forceCenter;
+        mAttractionCenter = mParticleSystem.attractor.center;
+    } else {
+        console() << "Replay has no step " << mReplaySeekStep << std::endl;
+    }
+}
+
+// Positions and colors of every frame into frames.clmf next to the
+// settings file, written on a background thread
+void ClimaxApp::toggleFrameExport()
+{
+    if (mFrameExporter.isRunning()){
+        mFrameExporter.stop();
+        console() << "Exported " << mFrameExporter.framesWritten() << " frames, dropped "
+                  << mFrameExporter.framesDropped() << std::endl;
+        return;
+    }
+
+    if (mSimulation.isRunning()){
+        console() << "Turn Threaded Simulation off first" << std::endl;
+        return;
+    }
+
+    fs::path path = getAppPath() / fs::path("frames.clmf");
+    if (mFrameExporter.start(path.string(), mParticleSystem.particles.capacity()))
+        console() << "Exporting frames to: " << path << std::endl;
+    else
+        console() << "Could not open " << path << std::endl;
+}
+
+// One row per frame next to the settings file until toggled off again
+void ClimaxApp::toggleProfileRecording()
+{
+    if (mProfiler.recording()){
+        mProfiler.closeCsv();
+        console() << "Stopped recording profile" << std::endl;
+        return;
+    }
+
+    fs::path path = getAppPath() / fs::path("profile.csv");
+    if (mProfiler.openCsv(path.string()))
+        console() << "Recording profile to: " << path << std::endl;
+    else
+        console() << "Could not open " << path << std::endl;
+}
 #endif
 
 void ClimaxApp::shutdown()
 {
+    mSimulation.stop();
+    mProfiler.closeCsv();
+    mRecorder.close();
+    mFrameExporter.stop();
 }
 
 CINDER_APP_NATIVE(ClimaxApp, RendererGl)
@@ -0,0 +1,97 @@
+#include "ConnectionBatch.h"
+
+
+#define DEFAULT_LINE_CAPACITY   65536
+
+ConnectionBatch::ConnectionBatch()
+{
+    setCapacity(DEFAULT_LINE_CAPACITY);
+    pairsTested = 0;
+}
+
+void ConnectionBatch::clear()
+{
+    vertices.clear();
+}
+
+// Lines past the capacity are dropped until it is raised
+void ConnectionBatch::setCapacity(size_t lines)
+{
+    maxLines = lines;
+    vertices.clear();
+    vertices.reserve(lines * 2);
+}
+
+// Each unordered pair once. The old per-pair drawing went over both (a, b)
+// and (b, a), blending lerp(a, b) over lerp(b, a); the color now runs
+// between those two along the line, and the alpha is that of the two
+// overlapping strokes.
+void ConnectionBatch::build(const ParticleStore & particles, float maxDistance,
+                            const WorldBounds & world)
+{
+    build(particles, particles.position, maxDistance, world);
+}
+
+// Same, with the particles drawn at `positions` instead of their own
+void ConnectionBatch::build(const ParticleStore & particles,
+                            const std::vector< ci::Vec2f > & positions, float maxDistance,
+                            const WorldBounds & world)
+{
+    build(positions, particles.color, particles.radius, maxDistance, world);
+}
+
+void ConnectionBatch::build(const std::vector< ci::Vec2f > & positions,
+                            const std::vector< ci::Color > & colors,
+                            const std::vector< float > & radii, float maxDistance,
+                            const WorldBounds & world)
+{
+    vertices.clear();
+    pairsTested = 0;
+    if (positions.empty() || ! (maxDistance > 0.f))
+        return;
+
+    const std::vector< ci::Vec2f > & position = positions;
+    const std::vector< ci::Color > & color = colors;
+    const std::vector< float > & radius = radii;
+    float maxDistanceSq = maxDistance * maxDistance;
+
+    // Nothing here reads the grid's velocity copies
+    grid.build(position, position, maxDistance, world);
+
+    for (size_t a = 0; a < position.size() && ! full(); a++){
+        grid.query(position[a], maxDistance, candidates);
+
+        for (auto b : candidates){
+            if (b <= a) continue;
+            pairsTested++;
+
+            ci::Vec2f shift = world.imageShift(position[b] - position[a]);
+            ci::Vec2f conVec = position[b] + shift - position[a];
+            float d2 = conVec.lengthSquared();
+            if (d2 <= 0.f || d2 >= maxDistanceSq) continue;
+
+            float distance = ci::math<float>::sqrt(d2);
+            float distancePercent = 1.f - (distance / maxDistance);
+            float alpha = distancePercent * .8f;
+            alpha = 1.f - (1.f - alpha) * (1.f - alpha);
+            conVec /= distance;
+
+            LineVertex start, end;
+            start.position = position[a] + conVec * (radius[a] + .5f);
+            start.color = ci::ColorA(ci::lerp(color[a], color[b], distancePercent), alpha);
+            end.position = position[b] + shift - conVec * (radius[b] + .5f);
+            end.color = ci::ColorA(ci::lerp(color[b], color[a], distancePercent), alpha);
+            vertices.push_back(start);
+            vertices.push_back(end);
+
+            if (shift != ci::Vec2f::zero() && ! full()){
+                start.position -= shift;
+                end.position -= shift;
+                vertices.push_back(start);
+                vertices.push_back(end);
+            }
+
+            if (full()) break;
+        }
+    }
+}
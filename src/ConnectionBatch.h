@@ -0,0 +1,58 @@
+#pragma once
+
+#include "cinder/Vector.h"
+#include "cinder/Color.h"
+
+#include "ParticleStore.h"
+#include "SpatialGrid.h"
+#include "WorldBounds.h"
+
+#include <vector>
+#include <cstdint>
+
+// Interleaved vertex as laid out for glVertexPointer/glColorPointer
+struct LineVertex {
+    ci::Vec2f   position;
+    ci::ColorA  color;
+};
+
+// Line geometry connecting every pair of particles closer than a distance,
+// built into one preallocated vertex buffer (two vertices per line) that is
+// drawn with a single call. Building doesn't touch GL.
+//
+// In a periodic world pairs are measured across the edges too, and a line
+// across an edge is drawn at both of them.
+class ConnectionBatch {
+
+    std::vector< LineVertex >   vertices;
+    size_t                      maxLines;
+
+    SpatialGrid                 grid;
+    std::vector< uint32_t >     candidates;
+    size_t                      pairsTested;
+
+public:
+
+    ConnectionBatch();
+
+    void build(const ParticleStore & particles, float maxDistance,
+               const WorldBounds & world = WorldBounds());
+    void build(const ParticleStore & particles,
+               const std::vector< ci::Vec2f > & positions, float maxDistance,
+               const WorldBounds & world = WorldBounds());
+    void build(const std::vector< ci::Vec2f > & positions,
+               const std::vector< ci::Color > & colors,
+               const std::vector< float > & radii, float maxDistance,
+               const WorldBounds & world = WorldBounds());
+    void clear();
+    void setCapacity(size_t lines);
+
+    const LineVertex * data() const { return vertices.data(); };
+    const std::vector< LineVertex > & getVertices() const { return vertices; };
+    size_t vertexCount() const { return vertices.size(); };
+    size_t lineCount() const { return vertices.size() / 2; };
+    size_t capacity() const { return maxLines; };
+    // Candidate pairs the last build() measured the distance of
+    size_t pairCount() const { return pairsTested; };
+    bool full() const { return lineCount() >= maxLines; };
+};
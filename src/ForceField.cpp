@@ -0,0 +1,135 @@
+#include "ForceField.h"
+
+#include <cmath>
+
+
+#define DEFAULT_REFRESH_STEPS   8
+
+// Step in noise space for the curl's central differences
+#define CURL_EPSILON            .01f
+
+ci::Vec2f Attractor::force(const ci::Vec2f & position) const
+{
+    ci::Vec2f force = ci::Vec2f::zero();
+
+    ci::Vec2f attrForce = center - position;
+    attrForce.normalize();
+    attrForce *= ci::math<float>::max(0.f, attraction - attrForce.length());
+    force += attrForce;
+
+    if (position.distance(center) > repulsionRadius){
+        ci::Vec2f repForce = position - center;
+        repForce = repForce.normalized() * ci::math<float>::max( 0.f, repulsion * ( repulsionRadius - repForce.length() ) );
+        force += repForce;
+    }
+    return force;
+}
+
+ForceField::ForceField() : perlin(4)
+{
+    cellSize = 0.f;
+    columns = 0;
+    rows = 0;
+    bandRows = 1;
+    baked = false;
+    lastStep = 0;
+    enabled = false;
+    noiseScale = .004f;
+    noiseStrength = .3f;
+    noiseSpeed = .002f;
+    refreshSteps = DEFAULT_REFRESH_STEPS;
+}
+
+void ForceField::setBounds(const ci::Rectf & bounds, float cellSize)
+{
+    this->bounds = bounds;
+    this->cellSize = cellSize;
+    columns = 0;
+    rows = 0;
+    if (cellSize > 0.f && bounds.getWidth() > 0.f && bounds.getHeight() > 0.f){
+        columns = (int)std::ceil(bounds.getWidth() / cellSize);
+        rows = (int)std::ceil(bounds.getHeight() / cellSize);
+    }
+    cells.assign((size_t)columns * rows, ci::Vec2f::zero());
+    baked = false;
+}
+
+// Curl of the noise, which swirls without sinks or sources, plus the
+// attractors
+ci::Vec2f ForceField::evaluate(const ci::Vec2f & position, float time) const
+{
+    ci::Vec2f force = ci::Vec2f::zero();
+
+    if (noiseStrength != 0.f){
+        float x = position.x * noiseScale;
+        float y = position.y * noiseScale;
+        float dx = perlin.fBm(x + CURL_EPSILON, y, time) - perlin.fBm(x - CURL_EPSILON, y, time);
+        float dy = perlin.fBm(x, y + CURL_EPSILON, time) - perlin.fBm(x, y - CURL_EPSILON, time);
+        force += ci::Vec2f(dy, -dx) * (noiseStrength / (2.f * CURL_EPSILON));
+    }
+
+    for (auto & attractor : attractors)
+        if (attractor.enabled)
+            force += attractor.force(position);
+    return force;
+}
+
+// Rows of one band as they were on `step`
+void ForceField::bakeBand(int band, int64_t step)
+{
+    float time = (float)((double)step * noiseSpeed);
+    int last = ci::math<int>::min((band + 1) * bandRows, rows);
+    for (int row = band * bandRows; row < last; row++){
+        float y = bounds.y1 + (row + .5f) * cellSize;
+        ci::Vec2f * cell = &cells[(size_t)row * columns];
+        for (int column = 0; column < columns; column++)
+            cell[column] = evaluate(ci::Vec2f(bounds.x1 + (column + .5f) * cellSize, y), time);
+    }
+}
+
+void ForceField::update(uint64_t step)
+{
+    if (cells.empty())
+        return;
+
+    int steps = ci::math<int>::max(refreshSteps, 1);
+    int rowsPerBand = (rows + steps - 1) / steps;
+    if (rowsPerBand != bandRows){
+        bandRows = rowsPerBand;
+        baked = false;
+    }
+    int bands = bandCount();
+
+    if (baked && step == lastStep + 1)
+        bakeBand((int)(step % bands), (int64_t)step);
+    else
+        // Each band as of the last step that baked it
+        for (int band = 0; band < bands; band++){
+            int64_t age = ((int64_t)step - band) % bands;
+            bakeBand(band, (int64_t)step - (age < 0 ? age + bands : age));
+        }
+
+    baked = true;
+    lastStep = step;
+}
+
+ci::Vec2f ForceField::sample(const ci::Vec2f & position) const
+{
+    if (cells.empty())
+        return ci::Vec2f::zero();
+
+    float u = ci::math<float>::clamp((position.x - bounds.x1) / cellSize - .5f, 0.f, (float)(columns - 1));
+    float v = ci::math<float>::clamp((position.y - bounds.y1) / cellSize - .5f, 0.f, (float)(rows - 1));
+    int c0 = (int)u;
+    int r0 = (int)v;
+    int c1 = ci::math<int>::min(c0 + 1, columns - 1);
+    int r1 = ci::math<int>::min(r0 + 1, rows - 1);
+    float fu = u - c0;
+    float fv = v - r0;
+
+    const ci::Vec2f & a = cells[(size_t)r0 * columns + c0];
+    const ci::Vec2f & b = cells[(size_t)r0 * columns + c1];
+    const ci::Vec2f & c = cells[(size_t)r1 * columns + c0];
+    const ci::Vec2f & d = cells[(size_t)r1 * columns + c1];
+    return (a * (1.f - fu) + b * fu) * (1.f - fv) + (c * (1.f - fu) + d * fu) * fv;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "cinder/Vector.h"
+#include "cinder/Rect.h"
+#include "cinder/Perlin.h"
+
+#include <vector>
+#include <cstdint>
+
+// Pull towards a center plus a push outwards past repulsionRadius
+struct Attractor {
+
+    Attractor() :
+        center(ci::Vec2f::zero()),
+        attraction(2.7f), repulsionRadius(200.f), repulsion(.8f),
+        enabled(false) {};
+
+    ci::Vec2f force(const ci::Vec2f & position) const;
+
+    ci::Vec2f   center;
+    float       attraction;
+    float       repulsionRadius, repulsion;
+    bool        enabled;
+};
+
+// External forces baked into a coarse grid of vectors over the borders:
+// curl noise for flowing motion plus any number of attractors. Particles
+// read it with one bilinear lookup, so their cost doesn't grow with the
+// number of sources, and update() rebakes only a band of rows per step,
+// spreading a full refresh over refreshSteps steps.
+//
+// The noise drifts with the step number alone, and each band is always
+// rebaked on the same steps, so the cells follow from the step number and
+// the settings; a restored or replayed system sees the field it had.
+class ForceField {
+
+    ci::Perlin                  perlin;
+    ci::Rectf                   bounds;
+    float                       cellSize;
+    int                         columns, rows;
+    std::vector< ci::Vec2f >    cells;
+    int                         bandRows;
+    bool                        baked;
+    uint64_t                    lastStep;
+
+    ci::Vec2f evaluate(const ci::Vec2f & position, float time) const;
+    void bakeBand(int band, int64_t step);
+    int bandCount() const { return (rows + bandRows - 1) / bandRows; };
+
+public:
+
+    ForceField();
+
+    // Covers `bounds` with cells of `cellSize`, baked on the next update;
+    // an empty rect leaves the field empty
+    void setBounds(const ci::Rectf & bounds, float cellSize);
+    const ci::Rectf & getBounds() const { return bounds; };
+
+    // Call before each step; rebakes that step's band, or everything
+    // when steps were skipped or the settings changed
+    void update(uint64_t step);
+    void invalidate() { baked = false; };
+
+    // Positions past the outer cell centers read the nearest edge
+    ci::Vec2f sample(const ci::Vec2f & position) const;
+
+    bool empty() const { return cells.empty(); };
+    int getColumns() const { return columns; };
+    int getRows() const { return rows; };
+    float getCellSize() const { return cellSize; };
+
+    bool                        enabled;
+
+    // Noise frequency per pixel, force per step, and how far the noise
+    // drifts each step; changing these needs invalidate()
+    float                       noiseScale;
+    float                       noiseStrength;
+    float                       noiseSpeed;
+
+    std::vector< Attractor >    attractors;
+
+    int                         refreshSteps;
+};
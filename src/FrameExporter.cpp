@@ -0,0 +1,119 @@
+#include "FrameExporter.h"
+
+#include <algorithm>
+#include <chrono>
+
+
+// Upper bound on how long a queued frame waits for the writer should a
+// wakeup be missed; notifying doesn't take the lock
+#define WRITER_POLL_MS  5
+
+static uint32_t packColor(const ci::Color & color)
+{
+    uint32_t r = (uint32_t)(ci::math<float>::clamp(color.r, 0.f, 1.f) * 255.f + .5f);
+    uint32_t g = (uint32_t)(ci::math<float>::clamp(color.g, 0.f, 1.f) * 255.f + .5f);
+    uint32_t b = (uint32_t)(ci::math<float>::clamp(color.b, 0.f, 1.f) * 255.f + .5f);
+    return r | (g << 8) | (b << 16) | (255u << 24);
+}
+
+FrameExporter::FrameExporter() : head(0), tail(0), dropped(0), stopping(false)
+{
+    file = NULL;
+    maxParticles = 0;
+}
+
+FrameExporter::~FrameExporter()
+{
+    stop();
+}
+
+bool FrameExporter::start(const std::string & path, size_t maxParticles, size_t slotCount)
+{
+    stop();
+
+    file = fopen(path.c_str(), "wb");
+    if (! file)
+        return false;
+
+    uint32_t header[2] = { FRAME_EXPORT_MAGIC, FRAME_EXPORT_VERSION };
+    fwrite(header, sizeof(header), 1, file);
+
+    // Everything the producer touches is allocated here, up front
+    this->maxParticles = maxParticles;
+    slots.resize(std::max< size_t >(slotCount, 2));
+    for (auto & slot : slots){
+        slot.count = 0;
+        slot.positions.resize(maxParticles);
+        slot.colors.resize(maxParticles);
+    }
+
+    head = 0;
+    tail = 0;
+    dropped = 0;
+    stopping = false;
+    writer = std::thread(& FrameExporter::writerLoop, this);
+    return true;
+}
+
+void FrameExporter::stop()
+{
+    if (! file)
+        return;
+
+    stopping = true;
+    wake.notify_one();
+    writer.join();
+
+    fclose(file);
+    file = NULL;
+}
+
+bool FrameExporter::publish(uint64_t frame, const ParticleStore & particles)
+{
+    if (! file)
+        return false;
+
+    uint64_t published = head.load(std::memory_order_relaxed);
+    if (published - tail.load(std::memory_order_acquire) >= slots.size()){
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Slot & slot = slots[published % slots.size()];
+    slot.frame = frame;
+    slot.count = (uint32_t)std::min(particles.size(), maxParticles);
+    std::copy(particles.position.begin(), particles.position.begin() + slot.count,
+              slot.positions.begin());
+    for (uint32_t i = 0; i < slot.count; i++)
+        slot.colors[i] = packColor(particles.color[i]);
+
+    head.store(published + 1, std::memory_order_release);
+    wake.notify_one();
+    return true;
+}
+
+void FrameExporter::writerLoop()
+{
+    for (;;){
+        uint64_t written = tail.load(std::memory_order_relaxed);
+        uint64_t published = head.load(std::memory_order_acquire);
+
+        if (written == published){
+            if (stopping)
+                break;
+            std::unique_lock< std::mutex > lock(wakeMutex);
+            wake.wait_for(lock, std::chrono::milliseconds(WRITER_POLL_MS));
+            continue;
+        }
+
+        for (; written < published; written++){
+            const Slot & slot = slots[written % slots.size()];
+            fwrite(&slot.frame, sizeof(slot.frame), 1, file);
+            fwrite(&slot.count, sizeof(slot.count), 1, file);
+            fwrite(slot.positions.data(), sizeof(ci::Vec2f), slot.count, file);
+            fwrite(slot.colors.data(), sizeof(uint32_t), slot.count, file);
+            tail.store(written + 1, std::memory_order_release);
+        }
+    }
+    fflush(file);
+}
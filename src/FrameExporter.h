@@ -0,0 +1,76 @@
+#pragma once
+
+#include "cinder/Vector.h"
+
+#include "ParticleStore.h"
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+
+// Streams every frame's particle positions and colors to a file from a
+// background thread, for post-production.
+//
+// publish() copies the frame into the next free slot of a preallocated
+// single-producer/single-consumer ring and returns; the writer thread
+// hands each slot's arrays straight to fwrite and frees it. When the disk
+// falls behind and the ring is full the frame is dropped and counted;
+// publishing never waits.
+//
+// File: a header (magic, version), then per frame the frame number, the
+// particle count, count x 2 float positions and count x RGBA8 colors, all
+// little-endian.
+
+#define FRAME_EXPORT_MAGIC      0x4d524643  // "CFRM"
+#define FRAME_EXPORT_VERSION    1
+
+class FrameExporter {
+
+    struct Slot {
+        uint64_t                    frame;
+        uint32_t                    count;
+        std::vector< ci::Vec2f >    positions;
+        std::vector< uint32_t >     colors;
+    };
+
+    std::vector< Slot >         slots;
+    size_t                      maxParticles;
+
+    // Frames published and written so far; head - tail slots are in use.
+    // Only the producer stores head, only the writer stores tail.
+    std::atomic< uint64_t >     head;
+    std::atomic< uint64_t >     tail;
+    std::atomic< uint64_t >     dropped;
+
+    FILE *                      file;
+    std::thread                 writer;
+    std::atomic< bool >         stopping;
+    std::mutex                  wakeMutex;
+    std::condition_variable     wake;
+
+    void writerLoop();
+
+public:
+
+    FrameExporter();
+    ~FrameExporter();
+
+    // Opens `path` and starts the writer with `slotCount` frames of up to
+    // `maxParticles` each; frames with more particles are cut to that
+    bool start(const std::string & path, size_t maxParticles, size_t slotCount = 16);
+
+    // Drains what's queued, then closes the file
+    void stop();
+    bool isRunning() const { return file != NULL; };
+
+    // Never blocks; false if the frame was dropped
+    bool publish(uint64_t frame, const ParticleStore & particles);
+
+    uint64_t framesWritten() const { return tail.load(std::memory_order_acquire); };
+    uint64_t framesDropped() const { return dropped.load(std::memory_order_relaxed); };
+};
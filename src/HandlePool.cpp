@@ -0,0 +1,70 @@
+#include "HandlePool.h"
+
+
+void HandlePool::setCapacity(size_t capacity)
+{
+    slotDense.assign(capacity, UINT32_MAX);
+    slotGeneration.assign(capacity, 1);
+    denseSlot.clear();
+    denseSlot.reserve(capacity);
+    freeSlots.clear();
+    freeSlots.reserve(capacity);
+    clear();
+}
+
+void HandlePool::clear()
+{
+    for (auto slot : denseSlot){
+        slotDense[slot] = UINT32_MAX;
+        slotGeneration[slot]++;
+    }
+    denseSlot.clear();
+
+    // Hand out low slots first
+    freeSlots.clear();
+    for (size_t slot = slotDense.size(); slot > 0; slot--)
+        freeSlots.push_back((uint32_t)(slot - 1));
+}
+
+PoolHandle HandlePool::acquire()
+{
+    if (freeSlots.empty())
+        return PoolHandle();
+
+    uint32_t slot = freeSlots.back();
+    freeSlots.pop_back();
+
+    slotDense[slot] = (uint32_t)denseSlot.size();
+    denseSlot.push_back(slot);
+    return PoolHandle(slot, slotGeneration[slot]);
+}
+
+// Returns the dense index that was vacated. The entry previously at
+// size() (after the call) now belongs there.
+size_t HandlePool::release(PoolHandle handle)
+{
+    uint32_t dense = slotDense[handle.index];
+    uint32_t last = denseSlot.back();
+
+    denseSlot[dense] = last;
+    slotDense[last] = dense;
+    denseSlot.pop_back();
+
+    slotDense[handle.index] = UINT32_MAX;
+    slotGeneration[handle.index]++;
+    freeSlots.push_back(handle.index);
+    return dense;
+}
+
+bool HandlePool::isValid(PoolHandle handle) const
+{
+    return handle.index < slotDense.size() &&
+           slotGeneration[handle.index] == handle.generation &&
+           slotDense[handle.index] != UINT32_MAX;
+}
+
+PoolHandle HandlePool::handleAt(size_t dense) const
+{
+    uint32_t slot = denseSlot[dense];
+    return PoolHandle(slot, slotGeneration[slot]);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Slot index plus the generation it was issued in. A handle whose slot has
+// since been released (and maybe reused) no longer validates.
+struct PoolHandle {
+
+    PoolHandle() : index(UINT32_MAX), generation(0) {};
+    PoolHandle(uint32_t index, uint32_t generation) : index(index), generation(generation) {};
+
+    bool operator==(const PoolHandle & other) const {
+        return index == other.index && generation == other.generation;
+    };
+    bool operator!=(const PoolHandle & other) const { return !(* this == other); };
+
+    uint32_t index;
+    uint32_t generation;
+};
+
+typedef PoolHandle ParticleHandle;
+typedef PoolHandle SpringHandle;
+
+// Fixed-capacity slot allocator mapping stable handles to a dense range
+// [0, size()). Releasing swaps the last dense entry into the hole, so the
+// owner moves its own arrays the same way; nothing allocates after
+// setCapacity().
+class HandlePool {
+
+    std::vector< uint32_t > slotDense;
+    std::vector< uint32_t > slotGeneration;
+    std::vector< uint32_t > denseSlot;
+    std::vector< uint32_t > freeSlots;
+
+public:
+
+    void setCapacity(size_t capacity);
+    void clear();
+
+    PoolHandle acquire();
+    size_t release(PoolHandle handle);
+
+    bool isValid(PoolHandle handle) const;
+    size_t denseIndex(PoolHandle handle) const { return slotDense[handle.index]; };
+    PoolHandle handleAt(size_t dense) const;
+
+    size_t size() const { return denseSlot.size(); };
+    size_t capacity() const { return slotDense.size(); };
+    bool full() const { return freeSlots.empty(); };
+};
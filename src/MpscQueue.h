@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+// Bounded multi-producer/single-consumer queue over a preallocated ring.
+// Producers claim a slot with a compare-and-swap on the tail and hand it
+// over through the slot's sequence number; the single consumer reads the
+// slots in order with plain loads and stores. Nothing blocks: push() fails
+// when the ring is full and pop() when it is empty.
+template< typename T >
+class MpscQueue {
+
+    struct Cell {
+        std::atomic< size_t >   sequence;
+        T                       value;
+    };
+
+    std::unique_ptr< Cell[] >   cells;
+    size_t                      mask;
+
+    // Next slot to claim, and for the consumer, next slot to read
+    std::atomic< size_t >       tail;
+    size_t                      head;
+
+public:
+
+    // Capacity is rounded up to a power of two
+    explicit MpscQueue(size_t capacity = 1024) : tail(0), head(0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    };
+
+    // A slot is free to claim once its sequence equals the claim position,
+    // and readable once it is one past it
+    bool push(const T & value)
+    {
+        size_t position = tail.load(std::memory_order_relaxed);
+        Cell * cell;
+        for (;;){
+            cell = &cells[position & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t lag = (intptr_t)sequence - (intptr_t)position;
+            if (lag == 0){
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    break;
+            } else if (lag < 0){
+                return false;
+            } else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = value;
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    };
+
+    // Consumer only
+    bool pop(T & value)
+    {
+        Cell & cell = cells[head & mask];
+        if (cell.sequence.load(std::memory_order_acquire) != head + 1)
+            return false;
+        value = cell.value;
+        cell.sequence.store(head + mask + 1, std::memory_order_release);
+        head++;
+        return true;
+    };
+
+    size_t capacity() const { return mask + 1; };
+};
@@ -1,83 +1,9 @@
 #include "Particle.h"
 
 
-Particle::Particle(const ci::Vec2f & position,
-                    float radius, float mass, float drag,
-                    float targetSeparation, float neighboringDistance,
-                    const ci::Color & color)
-{
-    this->position = position;
-    this->radius = radius;
-    this->mass = mass;
-    this->drag = drag;
-    this->targetSeparation = targetSeparation;
-    this->neighboringDistance = neighboringDistance;
-    this->color = color;
-    this->maxSpeed = 1.f;
-    this->maxForce = .05f;
-
-//    this->radius = targetSeparation / neighboringDistance * 1.6f;
-
-    anchor = position;
-    prevPosition = position;
-    forces = ci::Vec2f::zero();
-
-    separationEnabled = false;
-    separationFactor = 1.f;
-    alignmentEnabled = false;
-    alignmentFactor = 1.f;
-    cohesionEnabled = false;
-    cohesionFactor = 1.f;
-}
-
-void Particle::update()
-{
-    ci::Vec2f temp = position;
-
-    position += velocity + forces / mass;
-    prevPosition = temp;
-
-    forces = ci::Vec2f::zero();
-}
-
-void Particle::flock(std::vector<Particle *> & particles)
-{
-    ci::Vec2f acc = ci::Vec2f::zero();
-
-    if (separationEnabled)    acc += separate(particles) * separationFactor;
-    if (alignmentEnabled)     acc += align(particles) * alignmentFactor;
-    if (cohesionEnabled)      acc += cohesion(particles) * cohesionFactor;
-
-    velocity += acc;
-    velocity.limit(maxSpeed);
-}
-
-void Particle::borders(bool bounce)
-{
-    ci::Rectf borders(ci::app::getWindowBounds());
-
-    if (bounce)
-    {
-        if (position.x <= borders.getX1() || position.x >= borders.getX2()) velocity.x *= -1.f;
-        if (position.y <= borders.getY1() || position.y >= borders.getY2()) velocity.y *= -1.f;
-    }
-    else
-    {
-        if (position.x <= borders.getX1() + radius)
-             position.x = borders.getX2() - radius;
-
-        else if (position.y <= borders.getY1() + radius)
-            position.y = borders.getY2() - radius;
-
-        else if (position.x >= borders.getX2() - radius)
-            position.x = borders.getX1() + radius;
-
-        else if (position.y >= borders.getY2() - radius)
-            position.y = borders.getY1() + radius;
-    }
-}
-
-ci::Vec2f Particle::steer(ci::Vec2f target, bool slowdown)
+static ci::Vec2f steerTowards(ci::Vec2f target, bool slowdown,
+                              const ci::Vec2f & position, const ci::Vec2f & velocity,
+                              float maxSpeed, float maxForce)
 {
     ci::Vec2f steer;
     ci::Vec2f desired = target - position;
@@ -91,97 +17,172 @@ ci::Vec2f Particle::steer(ci::Vec2f target, bool slowdown)
     } else {
         steer = ci::Vec2f::zero();
     }
-    return steer;}
+    return steer;
+}
 
-ci::Vec2f Particle::separate(std::vector<Particle *> & particles)
+// Bounces off the borders of a closed world and comes back in on the
+// other side of a periodic one, on both axes at once. An unbounded world
+// leaves the particle be.
+static void constrain(const WorldBounds & world, ci::Vec2f & position, ci::Vec2f & velocity)
 {
-    ci::Vec2f resultVec = ci::Vec2f::zero();
+    if (! world.bounded())
+        return;
 
-    int count = 0;
-
-    for(auto it : particles)
+    const ci::Rectf & borders = world.rect;
+    if (world.periodic)
     {
-        ci::Vec2f diffVec = position - it->position;
-        if (diffVec.length() > 0 && diffVec.length() < targetSeparation)
-        {
-            resultVec += diffVec.normalized() / diffVec.length();
-            count++;
-        }
+        position = world.wrap(position);
     }
-
-    if (count >0)
+    else
     {
-        resultVec /= (float)count;
+        if (position.x <= borders.getX1() || position.x >= borders.getX2()) velocity.x *= -1.f;
+        if (position.y <= borders.getY1() || position.y >= borders.getY2()) velocity.y *= -1.f;
     }
+}
 
-    if (resultVec.length() > 0)
-    {
-        resultVec.normalize();
-        resultVec *= maxSpeed;
-        resultVec -= velocity;
-        resultVec.limit(maxForce);
-    }
-    return resultVec;
+Particle::Particle(ParticleStore & store, size_t index)
+{
+    this->store = & store;
+    this->index = index;
 }
 
-ci::Vec2f Particle::align(std::vector<Particle *> & particles)
+// Forces are left in place, the system clears them once per step
+void Particle::update(float dt)
 {
-    ci::Vec2f resultVec = ci::Vec2f::zero();
-    int count = 0;
-    for (auto it : particles) {
-        ci::Vec2f diffVec = position - it->position;
-        if(diffVec.length() >0 && diffVec.length() < neighboringDistance) {
-            resultVec += it->velocity;
-            count++;
-        }
-    }
+    ci::Vec2f & position = store->position[index];
+    position += (store->velocity[index] + store->forces[index] / store->mass[index]) * dt;
+}
 
-    if (count > 0)
-    {
-        resultVec /= (float)count;
+template< unsigned RULES >
+void Particle::flock(const FlockingRules & rules, const WorldBounds & world,
+                     const std::vector< uint32_t > & neighbors, float dt)
+{
+    ci::Vec2f & velocity = store->velocity[index];
+    if (RULES != 0){
+        FlockSums sums;
+        gather< RULES >(world, neighbors, sums);
+        velocity += flocking< RULES >(rules, sums, store->position[index], velocity) * dt;
     }
+    velocity.limit(store->maxSpeed[index]);
+}
 
-    if (resultVec.length() > 0)
+// Rule sums over the neighbors' state as currently held in the store
+template< unsigned RULES >
+void Particle::gather(const WorldBounds & world, const std::vector< uint32_t > & neighbors,
+                      FlockSums & sums) const
+{
+    bool wraps = world.wraps();
+    const ci::Vec2f * positions = store->position.data();
+    const ci::Vec2f * velocities = store->velocity.data();
+    const ci::Vec2f & position = store->position[index];
+    float separationSq = this->separationSq();
+    float neighboringSq = this->neighboringSq();
+
+    // diff / |diff|^2 is the same as diff.normalized() / diff.length()
+    // without the square roots.
+    for (auto it : neighbors)
     {
-        resultVec.normalize();
-        resultVec *= maxSpeed;
-        resultVec -= velocity;
-        resultVec.limit(maxForce);
+        ci::Vec2f diffVec = position - positions[it];
+        if (wraps)
+            diffVec = world.shortest(diffVec);
+        float d2 = diffVec.lengthSquared();
+        if (d2 <= 0.f) continue;
+
+        if ((RULES & FLOCK_SEPARATION) && d2 < separationSq)
+        {
+            sums.separation += diffVec / d2;
+            sums.separationCount++;
+        }
+        if ((RULES & (FLOCK_ALIGNMENT | FLOCK_COHESION)) && d2 < neighboringSq)
+        {
+            if (RULES & FLOCK_ALIGNMENT)
+                sums.velocity += velocities[it];
+            if (RULES & FLOCK_COHESION)
+                sums.position += wraps ? position - diffVec : positions[it];
+            sums.neighborCount++;
+        }
     }
-    return resultVec;
 }
 
-ci::Vec2f Particle::cohesion(std::vector<Particle *> & particles)
+// Steering for a particle at (position, velocity) from its rule sums. Only
+// the enabled rules take a lane of steerAlongSum(); a rule without
+// neighbors gets weight 0 rather than a branch.
+template< unsigned RULES >
+ci::Vec2f Particle::flocking(const FlockingRules & rules, const FlockSums & sums,
+                             const ci::Vec2f & position,
+                             const ci::Vec2f & velocity) const
 {
-    ci::Vec2f resultVec = ci::Vec2f::zero();
+    ci::Vec2f directions[3];
+    float weights[3];
     int count = 0;
-    for (auto it : particles)
-    {
-        if (resultVec.length() >0)
-        {
-            resultVec.normalize();
-            resultVec *= maxSpeed;
-            resultVec -= velocity;
-            resultVec.limit(maxForce);
-            float d = position.distance(it->position);
-            if (d > 0 && d < neighboringDistance)
-            {
-                resultVec += it->position;
-                count++;
-            }
-        }
+
+    if (RULES & FLOCK_SEPARATION){
+        directions[count] = sums.separation;
+        weights[count++] = sums.separationCount > 0 ? rules.separationFactor : 0.f;
+    }
+    if (RULES & FLOCK_ALIGNMENT){
+        directions[count] = sums.velocity;
+        weights[count++] = sums.neighborCount > 0 ? rules.alignmentFactor : 0.f;
     }
-    if (count >0) {
-        resultVec /= (float)count;
-        return steer(resultVec, false);
+    if (RULES & FLOCK_COHESION){
+        float neighbors = (float)ci::math<int>::max(sums.neighborCount, 1);
+        directions[count] = sums.neighborCount > 0 ? sums.position / neighbors - position : ci::Vec2f::zero();
+        weights[count++] = sums.neighborCount > 0 ? rules.cohesionFactor : 0.f;
     }
-    return resultVec;
+
+    if (count == 0)
+        return ci::Vec2f::zero();
+    return steerAlongSum(directions, weights, count, velocity,
+                         store->maxSpeed[index], store->maxForce[index]);
+}
+
+void Particle::borders(const WorldBounds & world)
+{
+    constrain(world, store->position[index], store->velocity[index]);
 }
 
-void Particle::draw()
+// borders(), update() and flock() without writing the store, so they can
+// run for many particles concurrently as long as nobody writes it either.
+// bordered() writes the constrained state into the given slots, advance()
+// then integrates it there. The sums must be gathered at the snapshot
+// position, where the particle's own entry has zero distance and drops out.
+void Particle::bordered(const WorldBounds & world,
+                        ci::Vec2f & nextPosition, ci::Vec2f & nextVelocity) const
 {
-    ci::gl::color(ci::ColorA(color, 1.f));
-    ci::gl::drawSolidCircle(position, radius * .8f);
-    ci::gl::color(ci::ColorA(color, .7f));
-    ci::gl::drawStrokedCircle(position, radius * 1.2f);
+    nextPosition = store->position[index];
+    nextVelocity = store->velocity[index];
+    constrain(world, nextPosition, nextVelocity);
 }
+
+template< unsigned RULES >
+void Particle::advance(const FlockingRules & rules, const FlockSums & sums, float dt,
+                       ci::Vec2f & nextPosition, ci::Vec2f & nextVelocity) const
+{
+    ci::Vec2f acc = flocking< RULES >(rules, sums, store->position[index], nextVelocity);
+    nextPosition += (nextVelocity + store->forces[index] / store->mass[index]) * dt;
+
+    nextVelocity += acc * dt;
+    nextVelocity.limit(store->maxSpeed[index]);
+}
+
+ci::Vec2f Particle::steer(ci::Vec2f target, bool slowdown)
+{
+    return steerTowards(target, slowdown,
+                        store->position[index], store->velocity[index],
+                        store->maxSpeed[index], store->maxForce[index]);
+}
+
+#define INSTANTIATE_FLOCKING(RULES) \
+    template void Particle::flock< RULES >(const FlockingRules &, const WorldBounds &, \
+                                           const std::vector< uint32_t > &, float); \
+    template void Particle::advance< RULES >(const FlockingRules &, const FlockSums &, float, \
+                                             ci::Vec2f &, ci::Vec2f &) const;
+
+INSTANTIATE_FLOCKING(0)
+INSTANTIATE_FLOCKING(1)
+INSTANTIATE_FLOCKING(2)
+INSTANTIATE_FLOCKING(3)
+INSTANTIATE_FLOCKING(4)
+INSTANTIATE_FLOCKING(5)
+INSTANTIATE_FLOCKING(6)
+INSTANTIATE_FLOCKING(7)
@@ -1,53 +1,73 @@
 #pragma once
 
-#include "cinder/gl/gl.h"
 #include "cinder/Vector.h"
 #include "cinder/Rect.h"
 #include "cinder/Color.h"
 
+#include "ParticleStore.h"
+#include "SimdKernels.h"
+#include "WorldBounds.h"
 
+#include <vector>
+#include <cstdint>
+
+
+// Lightweight view of one particle inside a ParticleStore. Views are cheap
+// to copy but only valid until the store removes or reorders particles.
 class Particle {
 
-    ci::Vec2f   prevPosition;
-    float       targetSeparation;
-    float       neighboringDistance;
+    ParticleStore * store;
+    size_t          index;
 
 public:
 
-    Particle();
-    Particle(const ci::Vec2f & position,
-              float radius, float mass, float drag,
-              float targetSeparation,
-              float neighboringDistance,
-              const ci::Color & color);
+    Particle(ParticleStore & store, size_t index);
 
-    void update();
-    void draw();
+    // dt is in frames of the original per-frame tuning, 1 for a full one
+    void update(float dt = 1.f);
 
-    void flock(std::vector<Particle * > & particles);
-    void borders(bool bounce = true);
+    // The flocking steps come in one instantiation per rule set, RULES
+    // being FlockingRules::mask() of the rules passed in; disabled rules
+    // are compiled out. Neighbors count at their nearest image in `world`.
+    template< unsigned RULES >
+    void flock(const FlockingRules & rules, const WorldBounds & world,
+               const std::vector< uint32_t > & neighbors, float dt = 1.f);
+    void borders(const WorldBounds & world);
+    void bordered(const WorldBounds & world, ci::Vec2f & nextPosition, ci::Vec2f & nextVelocity) const;
+    template< unsigned RULES >
+    void advance(const FlockingRules & rules, const FlockSums & sums, float dt,
+                 ci::Vec2f & nextPosition, ci::Vec2f & nextVelocity) const;
 
+    template< unsigned RULES >
+    void gather(const WorldBounds & world, const std::vector< uint32_t > & neighbors,
+                FlockSums & sums) const;
+    template< unsigned RULES >
+    ci::Vec2f flocking(const FlockingRules & rules, const FlockSums & sums,
+                       const ci::Vec2f & position,
+                       const ci::Vec2f & velocity) const;
     ci::Vec2f steer(ci::Vec2f target, bool slowdown);
-    ci::Vec2f separate(std::vector<Particle * > & particles);
-    ci::Vec2f align(std::vector<Particle * > & particles);
-    ci::Vec2f cohesion(std::vector<Particle * > & particles);
 
-    ci::Vec2f anchor;
-    ci::Vec2f position;
-    ci::Vec2f forces;
-    ci::Vec2f velocity;
+    float separationSq() const { return store->targetSeparation[index] * store->targetSeparation[index]; };
+    float neighboringSq() const { return store->neighboringDistance[index] * store->neighboringDistance[index]; };
+    float interactionRadius() const {
+        return ci::math<float>::max(store->targetSeparation[index],
+                                    store->neighboringDistance[index]);
+    };
+
+    size_t getIndex() const { return index; };
 
-    ci::Color color;
+    ci::Vec2f & anchor() const { return store->anchor[index]; };
+    ci::Vec2f & position() const { return store->position[index]; };
+    ci::Vec2f & forces() const { return store->forces[index]; };
+    ci::Vec2f & velocity() const { return store->velocity[index]; };
 
-    float separationFactor, alignmentFactor, cohesionFactor;
+    ci::Color & color() const { return store->color[index]; };
 
-    float radius;
-    float drag;
-    float maxSpeed;
-    float maxForce;
-    float mass;
+    ClusterId cluster() const { return store->cluster[index]; };
 
-    bool separationEnabled;
-    bool alignmentEnabled;
-    bool cohesionEnabled;
+    float & radius() const { return store->radius[index]; };
+    float & drag() const { return store->drag[index]; };
+    float & maxSpeed() const { return store->maxSpeed[index]; };
+    float & maxForce() const { return store->maxForce[index]; };
+    float & mass() const { return store->mass[index]; };
 };
@@ -1,32 +1,53 @@
 #pragma once
 
-#include "Particle.h"
+#include "cinder/Color.h"
 
+#include "SpatialGrid.h"
+#include "SimdKernels.h"
+
+#include <vector>
+#include <cstdint>
+
+// How strongly each flocking rule steers; a disabled rule doesn't
+struct FlockingRules {
+
+    FlockingRules() :
+        separationEnabled(false), alignmentEnabled(false), cohesionEnabled(false),
+        cohesionSteers(false),
+        separationFactor(1.f), alignmentFactor(1.f), cohesionFactor(1.f) {};
+
+    // The enabled rules as FLOCK_* bits. The original cohesion rule never
+    // accumulated a neighbor, so it never steered, and an enabled one still
+    // doesn't unless cohesionSteers opts in to steering towards the
+    // neighbors' center.
+    unsigned mask() const {
+        return (separationEnabled ? FLOCK_SEPARATION : 0) |
+               (alignmentEnabled ? FLOCK_ALIGNMENT : 0) |
+               (cohesionEnabled && cohesionSteers ? FLOCK_COHESION : 0);
+    };
+
+    bool        separationEnabled, alignmentEnabled, cohesionEnabled;
+    bool        cohesionSteers;
+    float       separationFactor, alignmentFactor, cohesionFactor;
+};
+
+// All particles of one color. They share one set of flocking rules and
+// only flock with and spring to each other, so each cluster indexes just
+// its own members.
 class ParticleCluster {
 
-    float       targetSeparation;
-    float       neighboringDistance;
-    
 public:
-    
-    ParticleCluster();
-    ParticleCluster(float targetSeparation,
-                    float neighboringDistance,
-                    const ci::Color & color) {
-        this->targetSeparation = targetSeparation;
-        this->neighboringDistance = neighboringDistance;
-        this->color = color;
-    };
-    
-    void addParticle(Particle * particle){
-        particles.push_back(particle);
-    };
-    void removeParticle(Particle * particle){
-        std::vector< Particle *>::const_iterator it = std::find(particles.begin(), particles.end(), particle);
-        delete * it;
-        particles.erase(it);
-    };
 
-    ci::Color color;
-    std::vector<Particle *> particles;
+    ParticleCluster(const ci::Color & color, const FlockingRules & rules) :
+        color(color), rules(rules) {};
+
+    ci::Color       color;
+    FlockingRules   rules;
+
+    // Dense indices of the members and a grid over them, both rebuilt
+    // along with the system's grid
+    std::vector< uint32_t >     members;
+    SpatialGrid                 grid;
 };
+
+typedef uint16_t ClusterId;
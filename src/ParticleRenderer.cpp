@@ -0,0 +1,188 @@
+#include "ParticleRenderer.h"
+
+
+ParticleRenderer::ParticleRenderer()
+{
+    connectionDistance = 100.f;
+    trailAlpha = .5f;
+    profiler = NULL;
+}
+
+void ParticleRenderer::draw(const ParticleSystem & system)
+{
+    const ParticleStore & particles = system.particles;
+
+    system.interpolatePositions(positions);
+    {
+        ProfileTimer timer(profiler, PROFILE_TRAILS);
+        system.trails.build(particles, positions, system.getWorld(), trailAlpha, trailVertices);
+        drawLines(trailVertices);
+    }
+    springLinks.resize(system.springs.size());
+    for (size_t i = 0; i < springLinks.size(); i++){
+        springLinks[i].a = (uint32_t)particles.indexOf(system.springs[i].particleA);
+        springLinks[i].b = (uint32_t)particles.indexOf(system.springs[i].particleB);
+    }
+    draw(particles.color, particles.radius, springLinks, system.getWorld());
+}
+
+void ParticleRenderer::draw(const RenderFrame & frame, double now)
+{
+    frame.interpolatePositions(now, positions);
+    {
+        ProfileTimer timer(profiler, PROFILE_TRAILS);
+        if (trailAlpha > 0.f)
+            trailVertices.assign(frame.trails.begin(), frame.trails.end());
+        else
+            trailVertices.clear();
+        for (auto & vertex : trailVertices)
+            vertex.color.a *= trailAlpha;
+        drawLines(trailVertices);
+    }
+    draw(frame.color, frame.radius, frame.springs, frame.world);
+}
+
+// Everything at `positions`
+void ParticleRenderer::draw(const std::vector< ci::Color > & colors, const std::vector< float > & radii,
+                            const std::vector< SpringLink > & springs, const WorldBounds & world)
+{
+    {
+        ProfileTimer timer(profiler, PROFILE_LINES);
+        connections.build(positions, colors, radii, connectionDistance, world);
+        drawLines(connections.getVertices());
+    }
+    if (profiler)
+        profiler->count(PROFILE_LINE_PAIRS, connections.pairCount());
+
+    {
+        ProfileTimer timer(profiler, PROFILE_SPRITES);
+        if (spriteTexture){
+            sprites.pack(positions, colors, radii);
+            drawSprites();
+        } else {
+            drawCircles(colors, radii);
+        }
+    }
+    drawSprings(springs, colors, radii, world);
+}
+
+// Two vertices per line, in one call
+void ParticleRenderer::drawLines(const std::vector< LineVertex > & vertices)
+{
+    if (vertices.empty())
+        return;
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, sizeof(LineVertex), &vertices[0].position);
+    glColorPointer(4, GL_FLOAT, sizeof(LineVertex), &vertices[0].color);
+    glDrawArrays(GL_LINES, 0, (GLsizei)vertices.size());
+    countDrawCalls(1);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+void ParticleRenderer::drawSprites()
+{
+    if (sprites.vertexCount() == 0)
+        return;
+
+    const SpriteVertex * vertices = sprites.data();
+    spriteTexture.enableAndBind();
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(2, GL_FLOAT, sizeof(SpriteVertex), &vertices[0].position);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(SpriteVertex), &vertices[0].texCoord);
+    glColorPointer(4, GL_FLOAT, sizeof(SpriteVertex), &vertices[0].color);
+    glDrawArrays(GL_TRIANGLES, 0, (GLsizei)sprites.vertexCount());
+    countDrawCalls(1);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    spriteTexture.unbind();
+    spriteTexture.disable();
+}
+
+void ParticleRenderer::drawCircles(const std::vector< ci::Color > & colors, const std::vector< float > & radii)
+{
+    for (size_t i = 0; i < positions.size(); i++){
+        const ci::Vec2f & position = positions[i];
+        const ci::Color & color = colors[i];
+        float radius = radii[i];
+
+        ci::gl::color(ci::ColorA(color, 1.f));
+        ci::gl::drawSolidCircle(position, radius * .8f);
+        ci::gl::color(ci::ColorA(color, .7f));
+        ci::gl::drawStrokedCircle(position, radius * 1.2f);
+    }
+    countDrawCalls(2 * positions.size());
+}
+
+// A spring across the edge of a periodic world is drawn at both edges,
+// each half reaching out to the image of the other particle
+void ParticleRenderer::drawSprings(const std::vector< SpringLink > & springs,
+                                   const std::vector< ci::Color > & colors, const std::vector< float > & radii,
+                                   const WorldBounds & world)
+{
+    size_t lines = 0;
+
+    for (auto & spring : springs){
+        size_t a = spring.a;
+        size_t b = spring.b;
+        const ci::Vec2f & positionA = positions[a];
+        const ci::Vec2f & positionB = positions[b];
+        ci::Vec2f shift = world.imageShift(positionB - positionA);
+
+        float distBetweenParticles = positionA.distance(positionB + shift);
+        float distancePercent = 1.f - (distBetweenParticles / 100.f);
+
+        if (distancePercent > 0.f){
+            ci::Color colorFirst = ci::lerp(colors[a], colors[b], distancePercent);
+            ci::gl::color(ci::ColorA( colorFirst, distancePercent * .8f));
+            ci::Vec2f conVec = positionB + shift - positionA;
+            conVec.normalize();
+            ci::gl::drawLine(positionA + conVec * (radii[a] + .5f),
+                              positionB + shift - conVec * (radii[b] + .5f));
+            lines++;
+            if (shift != ci::Vec2f::zero()){
+                ci::gl::drawLine(positionA - shift + conVec * (radii[a] + .5f),
+                                  positionB - conVec * (radii[b] + .5f));
+                lines++;
+            }
+        }
+    }
+    countDrawCalls(lines);
+}
+
+void ParticleRenderer::countDrawCalls(size_t calls)
+{
+    if (profiler)
+        profiler->count(PROFILE_DRAW_CALLS, calls);
+}
+
+// The disc at its own height, padded out to a square cell, next to a
+// generated ring; see SpriteBatch::HALO_COORDS
+ci::Surface ParticleRenderer::makeAtlas(const ci::Surface & disc)
+{
+    int size = disc.getHeight();
+    ci::Surface atlas(size * 2, size, true);
+    int discWidth = ci::math<int>::min(disc.getWidth(), size);
+    atlas.copyFrom(disc, ci::Area(0, 0, discWidth, size));
+
+    float half = size * .5f;
+    for (int y = 0; y < size; y++){
+        for (int x = discWidth; x < size; x++)
+            atlas.setPixel(ci::Vec2i(x, y), ci::ColorA8u(255, 255, 255, 0));
+
+        for (int x = 0; x < size; x++){
+            ci::Vec2f offset((x + .5f) / half - 1.f, (y + .5f) / half - 1.f);
+            float fromRing = ci::math<float>::abs(offset.length() - SpriteBatch::RING_RADIUS);
+            float coverage = 1.f - fromRing / SpriteBatch::RING_HALF_WIDTH;
+            coverage = ci::math<float>::clamp(coverage, 0.f, 1.f);
+            atlas.setPixel(ci::Vec2i(size + x, y),
+                           ci::ColorA8u(255, 255, 255, (unsigned char)(coverage * 255.f)));
+        }
+    }
+    return atlas;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "cinder/gl/gl.h"
+#include "cinder/gl/Texture.h"
+#include "cinder/Surface.h"
+
+#include "ParticleSystem.h"
+#include "RenderFrame.h"
+#include "ConnectionBatch.h"
+#include "SpriteBatch.h"
+#include "Profiler.h"
+
+// GL drawing for a ParticleSystem, kept out of the simulation core so that
+// builds without a window don't need OpenGL.
+class ParticleRenderer {
+
+    std::vector< SpringLink >   springLinks;
+    std::vector< LineVertex >   trailVertices;
+
+    void draw(const std::vector< ci::Color > & colors, const std::vector< float > & radii,
+              const std::vector< SpringLink > & springs, const WorldBounds & world);
+    void drawLines(const std::vector< LineVertex > & vertices);
+    void drawSprites();
+    void drawCircles(const std::vector< ci::Color > & colors, const std::vector< float > & radii);
+    void drawSprings(const std::vector< SpringLink > & springs,
+                     const std::vector< ci::Color > & colors, const std::vector< float > & radii,
+                     const WorldBounds & world);
+    void countDrawCalls(size_t calls);
+
+public:
+
+    ParticleRenderer();
+
+    void draw(const ParticleSystem & system);
+
+    // A frame captured on the simulation thread, as of `now` on the
+    // clock it was captured against
+    void draw(const RenderFrame & frame, double now);
+
+    // Particles closer than this are joined by a line
+    float           connectionDistance;
+
+    // Opacity of the newest segment of each trail; 0 skips them
+    float           trailAlpha;
+
+    ConnectionBatch connections;
+    SpriteBatch     sprites;
+
+    // Positions drawn this frame, interpolated between the last two steps
+    std::vector< ci::Vec2f > positions;
+
+    // Atlas from makeAtlas(); without it particles are drawn
+    // one by one as circles
+    ci::gl::Texture spriteTexture;
+
+    // The sprite atlas for a disc image, laid out as SpriteBatch expects
+    static ci::Surface makeAtlas(const ci::Surface & disc);
+
+    // Trail, line and sprite times, line pairs and draw calls go here when set
+    Profiler *      profiler;
+};
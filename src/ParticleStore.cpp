@@ -0,0 +1,188 @@
+#include "ParticleStore.h"
+
+
+#define DEFAULT_PARTICLE_CAPACITY   4096
+
+template< typename T >
+static void moveLast(std::vector< T > & values, size_t index)
+{
+    values[index] = values.back();
+    values.pop_back();
+}
+
+template< typename T >
+static void resetArray(std::vector< T > & values, size_t capacity)
+{
+    values.clear();
+    values.reserve(capacity);
+}
+
+ParticleStore::ParticleStore()
+{
+    setCapacity(DEFAULT_PARTICLE_CAPACITY);
+}
+
+ParticleHandle ParticleStore::add(const ci::Vec2f & position,
+                                  float radius, float mass, float drag,
+                                  float targetSeparation, float neighboringDistance,
+                                  const ci::Color & color, ClusterId cluster)
+{
+    ParticleHandle handle = handles.acquire();
+    if (! handles.isValid(handle))
+        return handle;
+
+    this->position.push_back(position);
+    this->velocity.push_back(ci::Vec2f::zero());
+    this->forces.push_back(ci::Vec2f::zero());
+    this->mass.push_back(mass);
+
+    this->prevPosition.push_back(position);
+    this->anchor.push_back(position);
+    this->color.push_back(color);
+    this->radius.push_back(radius);
+    this->drag.push_back(drag);
+    this->maxSpeed.push_back(1.f);
+    this->maxForce.push_back(.05f);
+    this->targetSeparation.push_back(targetSeparation);
+    this->neighboringDistance.push_back(neighboringDistance);
+    this->cluster.push_back(cluster);
+
+    // Evicting the oldest particle at capacity leaves its stale entry at the
+    // head, and dropping that first keeps sustained emission from compacting
+    // the whole ring on every add
+    if (spawnCount == spawnOrder.size())
+        oldest();
+    if (spawnCount == spawnOrder.size())
+        compactSpawnOrder();
+    spawnOrder[(spawnHead + spawnCount) % spawnOrder.size()] = handle;
+    spawnCount++;
+
+    return handle;
+}
+
+void ParticleStore::remove(ParticleHandle handle)
+{
+    if (! handles.isValid(handle))
+        return;
+
+    // Its entry in spawnOrder goes stale and is skipped by oldest()
+    size_t index = handles.release(handle);
+
+    moveLast(position, index);
+    moveLast(velocity, index);
+    moveLast(forces, index);
+    moveLast(mass, index);
+
+    moveLast(prevPosition, index);
+    moveLast(anchor, index);
+    moveLast(color, index);
+    moveLast(radius, index);
+    moveLast(drag, index);
+    moveLast(maxSpeed, index);
+    moveLast(maxForce, index);
+    moveLast(targetSeparation, index);
+    moveLast(neighboringDistance, index);
+    moveLast(cluster, index);
+}
+
+ParticleHandle ParticleStore::oldest()
+{
+    while (spawnCount > 0){
+        ParticleHandle handle = spawnOrder[spawnHead];
+        if (handles.isValid(handle))
+            return handle;
+        spawnHead = (spawnHead + 1) % spawnOrder.size();
+        spawnCount--;
+    }
+    return ParticleHandle();
+}
+
+void ParticleStore::emissionOrder(std::vector< uint32_t > & indices) const
+{
+    indices.clear();
+    for (size_t i = 0; i < spawnCount; i++){
+        ParticleHandle handle = spawnOrder[(spawnHead + i) % spawnOrder.size()];
+        if (handles.isValid(handle))
+            indices.push_back((uint32_t)handles.denseIndex(handle));
+    }
+}
+
+void ParticleStore::setEmissionOrder(const std::vector< uint32_t > & indices)
+{
+    spawnHead = 0;
+    spawnCount = 0;
+    for (auto index : indices)
+        if (index < size() && spawnCount < spawnOrder.size())
+            spawnOrder[spawnCount++] = handles.handleAt(index);
+}
+
+// Only reached when particles were removed out of emission order and their
+// stale entries fill the ring; squeezes them out in place.
+void ParticleStore::compactSpawnOrder()
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < spawnCount; i++){
+        ParticleHandle handle = spawnOrder[(spawnHead + i) % spawnOrder.size()];
+        if (handles.isValid(handle))
+            spawnOrder[(spawnHead + kept++) % spawnOrder.size()] = handle;
+    }
+    spawnCount = kept;
+}
+
+// Publishes nextPosition/nextVelocity as the current state. Only swaps
+// array storage.
+void ParticleStore::swapBuffers()
+{
+    position.swap(nextPosition);
+    velocity.swap(nextVelocity);
+}
+
+void ParticleStore::clear()
+{
+    handles.clear();
+    spawnHead = 0;
+    spawnCount = 0;
+
+    position.clear();
+    velocity.clear();
+    forces.clear();
+    mass.clear();
+
+    prevPosition.clear();
+    anchor.clear();
+    color.clear();
+    radius.clear();
+    drag.clear();
+    maxSpeed.clear();
+    maxForce.clear();
+    targetSeparation.clear();
+    neighboringDistance.clear();
+    cluster.clear();
+}
+
+// Drops every particle and preallocates all arrays for `capacity` of them
+void ParticleStore::setCapacity(size_t capacity)
+{
+    handles.setCapacity(capacity);
+    spawnOrder.assign(capacity, ParticleHandle());
+    spawnHead = 0;
+    spawnCount = 0;
+
+    resetArray(position, capacity);
+    resetArray(velocity, capacity);
+    resetArray(forces, capacity);
+    resetArray(mass, capacity);
+    resetArray(nextPosition, capacity);
+    resetArray(nextVelocity, capacity);
+
+    resetArray(prevPosition, capacity);
+    resetArray(anchor, capacity);
+    resetArray(color, capacity);
+    resetArray(radius, capacity);
+    resetArray(drag, capacity);
+    resetArray(maxSpeed, capacity);
+    resetArray(maxForce, capacity);
+    resetArray(targetSeparation, capacity);
+    resetArray(neighboringDistance, capacity);
+    resetArray(cluster, capacity);
+}
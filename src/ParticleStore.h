@@ -0,0 +1,81 @@
+#pragma once
+
+#include "cinder/Vector.h"
+#include "cinder/Color.h"
+
+#include "HandlePool.h"
+#include "ParticleCluster.h"
+
+#include <vector>
+
+// Structure-of-arrays storage for every live particle. The arrays touched by
+// the per-frame simulation loops are kept apart from the attributes only
+// read at spawn or draw time, so neighbor scans stream through memory.
+//
+// Storage is fixed-capacity: particles are addressed from outside through
+// generation-checked handles, the arrays stay dense through swap-and-pop
+// removal, and a ring of handles remembers emission order.
+class ParticleStore {
+
+    HandlePool                      handles;
+
+    std::vector< ParticleHandle >   spawnOrder;
+    size_t                          spawnHead, spawnCount;
+
+    void compactSpawnOrder();
+
+public:
+
+    ParticleStore();
+
+    ParticleHandle add(const ci::Vec2f & position,
+                       float radius, float mass, float drag,
+                       float targetSeparation,
+                       float neighboringDistance,
+                       const ci::Color & color,
+                       ClusterId cluster = 0);
+    void remove(ParticleHandle handle);
+    void clear();
+    void setCapacity(size_t capacity);
+
+    ParticleHandle oldest();
+
+    // Dense indices of the live particles, oldest first, and back
+    void emissionOrder(std::vector< uint32_t > & indices) const;
+    void setEmissionOrder(const std::vector< uint32_t > & indices);
+
+    void swapBuffers();
+
+    bool isValid(ParticleHandle handle) const { return handles.isValid(handle); };
+    size_t indexOf(ParticleHandle handle) const { return handles.denseIndex(handle); };
+    ParticleHandle handleAt(size_t index) const { return handles.handleAt(index); };
+
+    size_t size() const { return position.size(); };
+    size_t capacity() const { return handles.capacity(); };
+    bool empty() const { return position.empty(); };
+    bool full() const { return handles.full(); };
+
+    // Hot simulation state
+    std::vector< ci::Vec2f >    position;
+    std::vector< ci::Vec2f >    velocity;
+    std::vector< ci::Vec2f >    forces;
+    std::vector< float >        mass;
+
+    // Back buffers written by the parallel step, see swapBuffers()
+    std::vector< ci::Vec2f >    nextPosition;
+    std::vector< ci::Vec2f >    nextVelocity;
+
+    // Cold attributes; prevPosition is where the current step started
+    std::vector< ci::Vec2f >    prevPosition;
+    std::vector< ci::Vec2f >    anchor;
+    std::vector< ci::Color >    color;
+    std::vector< float >        radius;
+    std::vector< float >        drag;
+    std::vector< float >        maxSpeed;
+    std::vector< float >        maxForce;
+    std::vector< float >        targetSeparation;
+    std::vector< float >        neighboringDistance;
+
+    // Index of each particle's cluster in its ParticleSystem
+    std::vector< ClusterId >    cluster;
+};
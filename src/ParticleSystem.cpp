@@ -1,102 +1,670 @@
-#include "cinder/app/AppBasic.h"
 #include "cinder/Rand.h"
 #include "ParticleSystem.h"
 
+#include <algorithm>
+#include <cmath>
 
-ParticleSystem::~ParticleSystem()
+
+// Particles added since the last grid build are scanned linearly by every
+// new particle, while a rebuild is linear in all particles; rebuilding once
+// there are about sqrt(n) of them keeps large bursts of emission at
+// O(sqrt(n)) per particle instead of going quadratic.
+#define MIN_UNGRIDDED           64
+
+// Pixels per force field cell; the noise varies over a few hundred
+#define FORCE_FIELD_CELL_SIZE   32.f
+
+ParticleSystem::ParticleSystem()
+{
+    maxParticles = MAX_PARTICLES;
+    evictionMode = EVICT_EXCESS_FIFO;
+    parallelStep = false;
+    workerThreads = 0;
+    canonicalOrder = false;
+    profiler = NULL;
+    springsPerParticle = 4;
+    springRadius = 100.f;
+    springIterations = 1;
+    timeStep = 1.f / 60.f;
+    substeps = 1;
+    maxStepsPerUpdate = 4;
+    accumulator = 0.0;
+    stepCount = 0;
+    reseed(0);
+    gridStale = true;
+    particleSprings.resize(particles.capacity());
+}
+
+// Preallocates both pools; emitting and evicting below these limits never
+// touches the heap. Drops all current particles and springs.
+void ParticleSystem::setCapacity(size_t particleCapacity, size_t springCapacity)
 {
-    clear();
+    particles.setCapacity(particleCapacity);
+    springs.setCapacity(springCapacity, particleCapacity);
+    trails.setSize(particleCapacity, trails.getLength());
+    particleSprings.clear();
+    particleSprings.resize(particleCapacity);
+    gridStale = true;
 }
 
 void ParticleSystem::clear()
 {
-    for (auto it : particles){
-        delete it;
-    }
     particles.clear();
+    springs.clear();
+    clusters.clear();
+    trails.clear();
+
+    // Keep each list's capacity for the particles that reuse the slot
+    for (auto & attached : particleSprings)
+        attached.clear();
+    gridStale = true;
+}
 
-    for(auto it : springs){
-        delete it;
+// Runs as many fixed steps as fit into the time passed since the last
+// call, but never more than maxStepsPerUpdate; time beyond that is dropped,
+// so frames slower than the budget slow the simulation down instead of
+// making the next frame slower still. Returns the number of steps taken.
+int ParticleSystem::update(double elapsedSeconds)
+{
+    if (! (timeStep > 0.f))
+        return 0;
+
+    accumulator += ci::math<double>::max(elapsedSeconds, 0.0);
+
+    int steps = 0;
+    while (accumulator >= timeStep && steps < maxStepsPerUpdate){
+        update();
+        accumulator -= timeStep;
+        steps++;
     }
-    springs.clear();
+    if (accumulator >= timeStep)
+        accumulator = std::fmod(accumulator, (double)timeStep);
+    return steps;
 }
 
+// One fixed step of timeStep seconds, split into substeps; every rate in
+// the system is tuned per step.
 void ParticleSystem::update()
 {
-    if (particles.size() > maxParticles)
-        destroyParticle(* particles.begin());
+    {
+        ProfileTimer timer(profiler, PROFILE_EVICTION);
+        evictExcess();
+    }
+    {
+        ProfileTimer timer(profiler, PROFILE_ATTRACTION);
+        applyAttractor();
+    }
+    {
+        ProfileTimer timer(profiler, PROFILE_FIELD);
+        applyForceField();
+    }
+
+    particles.prevPosition = particles.position;
+
+    int count = ci::math<int>::max(substeps, 1);
+    float dt = 1.f / count;
+    for (int i = 0; i < count; i++){
+        updateParticles(dt);
+        updateSprings(dt);
+    }
+
+    std::fill(particles.forces.begin(), particles.forces.end(), ci::Vec2f::zero());
+    trails.record(particles);
+    stepCount++;
+}
+
+// Borders, integration and flocking for every particle
+void ParticleSystem::updateParticles(float dt)
+{
+    {
+        ProfileTimer timer(profiler, PROFILE_GRID);
+        rebuildGrid();
+    }
+
+    if (parallelStep)
+        stepParallel(dt);
+    else
+        stepSerial(dt);
+}
+
+void ParticleSystem::updateSprings(float dt)
+{
+    ProfileTimer timer(profiler, PROFILE_SPRINGS);
+    if (springPass)
+        springPass(dt);
+    else
+        springs.update(particles, world, dt, springIterations,
+                       parallelStep ? & workers() : NULL);
+}
+
+// How far rendering is between the previous and the latest step, from 0
+// to 1; see interpolatePositions()
+float ParticleSystem::getInterpolation() const
+{
+    if (! (timeStep > 0.f))
+        return 1.f;
+    return ci::math<float>::clamp((float)(accumulator / timeStep), 0.f, 1.f);
+}
+
+// A particle that wrapped around during the step moves on past the edge it
+// left by rather than back across the world
+void ParticleSystem::interpolatePositions(std::vector< ci::Vec2f > & positions) const
+{
+    float alpha = getInterpolation();
+    positions.resize(particles.size());
+    for (size_t i = 0; i < particles.size(); i++)
+        positions[i] = particles.prevPosition[i] + world.delta(particles.prevPosition[i], particles.position[i]) * alpha;
+}
+
+ThreadPool & ParticleSystem::workers()
+{
+    if (! threadPool){
+        threadPool.reset(new ThreadPool(workerThreads));
+        workerScratch.resize(threadPool->size());
+    }
+    return * threadPool;
+}
+
+// One instantiation of a per cluster pass for each rule set, indexed by
+// FlockingRules::mask()
+#define RULE_SET_TABLE(pass) { \
+    & ParticleSystem::pass< 0 >, & ParticleSystem::pass< 1 >, \
+    & ParticleSystem::pass< 2 >, & ParticleSystem::pass< 3 >, \
+    & ParticleSystem::pass< 4 >, & ParticleSystem::pass< 5 >, \
+    & ParticleSystem::pass< 6 >, & ParticleSystem::pass< 7 > }
 
-    for (auto particle : particles){
-        particle->borders(true);
-        particle->update();
-        particle->flock(particles);
+// Calls pass(cluster, from, to) for the members [from, to) of each cluster
+// that overlap [begin, end) of all members laid end to end
+template< typename Pass >
+void ParticleSystem::forClusterRanges(size_t begin, size_t end, const Pass & pass) const
+{
+    size_t c = std::upper_bound(clusterStart.begin(), clusterStart.end(), (uint32_t)begin) -
+               clusterStart.begin() - 1;
+    for (; c < clusters.size() && clusterStart[c] < end; c++){
+        size_t from = std::max< size_t >(begin, clusterStart[c]) - clusterStart[c];
+        size_t to = std::min< size_t >(end, clusterStart[c + 1]) - clusterStart[c];
+        if (from < to)
+            pass(clusters[c], from, to);
     }
+}
 
-    for (auto spring : springs)
-        spring->update();
+// Particles only flock within their cluster, so stepping one cluster after
+// another moves them the same as going through all of them in order.
+template< unsigned RULES >
+uint64_t ParticleSystem::stepClusterSerial(const ParticleCluster & cluster, float dt)
+{
+    uint64_t pairs = 0;
+
+    for (auto i : cluster.members){
+        Particle particle(particles, i);
+        particle.borders(world);
+        particle.update(dt);
+        if (RULES != 0){
+            cluster.grid.query(particles.position[i], neighbors);
+            pairs += neighbors.size();
+        }
+        particle.flock< RULES >(cluster.rules, world, neighbors, dt);
+    }
+    return pairs;
 }
 
-void ParticleSystem::draw()
+// In place, so later particles see a mix of moved and unmoved neighbors.
+// The phases alternate per particle here, and reading the clock around
+// each of them would cost more than some of them do, so the whole step is
+// timed once as flocking, borders and integration included.
+void ParticleSystem::stepSerial(float dt)
 {
-    for(auto particleA : particles){
-        for (auto particleB : particles){
-            
-            float distBetweenParticles = particleA->position.distance(particleB->position);
-            float distancePercent = 1.f - (distBetweenParticles / 100.f);
-            
-            if (distancePercent > 0.f){
-                ci::Color colorFirst = ci::lerp(particleA->color, particleB->color, distancePercent);
-                ci::gl::color(ci::ColorA( colorFirst, distancePercent * .8f));
-                ci::Vec2f conVec = particleB->position - particleA->position;
-                conVec.normalize();
-                ci::gl::lineWidth( distancePercent );
-                ci::gl::drawLine(particleA->position + conVec * (particleA->radius + .5f),
-                                 particleB->position - conVec * (particleB->radius + .5f));
-            }
+    typedef uint64_t (ParticleSystem::* ClusterStep)(const ParticleCluster &, float);
+    static const ClusterStep steps[FLOCK_RULE_SETS] = RULE_SET_TABLE(stepClusterSerial);
+
+    ProfileTimer timer(profiler, PROFILE_FLOCK);
+    uint64_t pairs = 0;
+    for (auto & cluster : clusters)
+        pairs += (this->*steps[cluster.rules.mask()])(cluster, dt);
+
+    if (profiler)
+        profiler->count(PROFILE_NEIGHBOR_PAIRS, pairs);
+}
+
+// Without rules nothing reads the sums, so there's no neighbor scan
+template< unsigned RULES >
+uint64_t ParticleSystem::gatherMembers(const ParticleCluster & cluster, size_t begin, size_t end,
+                                       NeighborScratch & scratch)
+{
+    if (RULES == 0)
+        return 0;
+
+    const SpatialGrid & grid = cluster.grid;
+    std::vector< GridSpan > & spans = scratch.spans;
+    uint64_t pairs = 0;
+    for (size_t m = begin; m < end; m++){
+        uint32_t i = cluster.members[m];
+        Particle particle(particles, i);
+        const ci::Vec2f & position = particles.position[i];
+
+        // The cluster grid's cell-ordered copies are the snapshot, read a
+        // row of cells at a time by the SIMD kernel. Across the edge of a
+        // periodic world the particle is shifted instead of its neighbors,
+        // whose position sum then takes the shift back.
+        FlockSums & sums = flockSums[i];
+        sums.clear();
+        grid.query(position, grid.cellSize, spans);
+        if (canonicalOrder){
+            accumulateSorted< RULES >(grid, particle, scratch, sums);
+            for (auto & span : spans)
+                pairs += span.end - span.begin;
+            continue;
+        }
+        for (auto & span : spans){
+            int neighborCount = sums.neighborCount;
+            accumulateFlocking< RULES >(&grid.cellX[span.begin], &grid.cellY[span.begin],
+                                        &grid.cellVelocityX[span.begin], &grid.cellVelocityY[span.begin],
+                                        span.end - span.begin, position - span.shift,
+                                        particle.separationSq(), particle.neighboringSq(), sums);
+            if (RULES & FLOCK_COHESION)
+                sums.position += span.shift * (float)(sums.neighborCount - neighborCount);
+            pairs += span.end - span.begin;
         }
-        particleA->draw();
     }
-    for(auto spring : springs)        spring->draw();
+    return pairs;
+}
+
+bool ParticleSystem::FlockNeighbor::operator<(const FlockNeighbor & other) const
+{
+    if (x != other.x) return x < other.x;
+    if (y != other.y) return y < other.y;
+    if (vx != other.vx) return vx < other.vx;
+    return vy < other.vy;
 }
 
-void ParticleSystem::addParticle(Particle *particle)
+// The sums over the neighbors within the particle's interaction radius in
+// the spans scratch holds, in one kernel call over them sorted; neighbors
+// that compare equal add the same terms, so their order doesn't matter.
+template< unsigned RULES >
+void ParticleSystem::accumulateSorted(const SpatialGrid & grid, const Particle & particle,
+                                      NeighborScratch & scratch, FlockSums & sums)
 {
-    particles.push_back(particle);
+    const ci::Vec2f & position = particle.position();
+    float reachSq = ci::math<float>::max(particle.separationSq(), particle.neighboringSq());
 
-    for (auto second : particles){
-        if (particle != second && particle->color == second->color){
-            float d = particle->position.distance(second->position);
-            float d2 = (particle->radius + second->radius) * 50.f;
-            
-            if (d > 0.f && d2 < 200.f){
-                Spring * spring = new Spring(particle, second,
-                                             d * ci::randFloat(.4f, 1.8f),
-                                             ci::randFloat(.0001f, .005f));
-                addSpring(spring);
-            }
+    scratch.sorted.clear();
+    for (auto & span : scratch.spans){
+        for (int entry = span.begin; entry < span.end; entry++){
+            FlockNeighbor neighbor = { grid.cellX[entry] + span.shift.x, grid.cellY[entry] + span.shift.y,
+                                       grid.cellVelocityX[entry], grid.cellVelocityY[entry] };
+            if (ci::Vec2f(neighbor.x, neighbor.y).distanceSquared(position) < reachSq)
+                scratch.sorted.push_back(neighbor);
         }
     }
+    std::sort(scratch.sorted.begin(), scratch.sorted.end());
+
+    size_t count = scratch.sorted.size();
+    scratch.x.resize(count);
+    scratch.y.resize(count);
+    scratch.vx.resize(count);
+    scratch.vy.resize(count);
+    for (size_t k = 0; k < count; k++){
+        scratch.x[k] = scratch.sorted[k].x;
+        scratch.y[k] = scratch.sorted[k].y;
+        scratch.vx[k] = scratch.sorted[k].vx;
+        scratch.vy[k] = scratch.sorted[k].vy;
+    }
+    accumulateFlocking< RULES >(scratch.x.data(), scratch.y.data(), scratch.vx.data(), scratch.vy.data(),
+                                count, position, particle.separationSq(), particle.neighboringSq(), sums);
+}
+
+template< unsigned RULES >
+void ParticleSystem::advanceMembers(const ParticleCluster & cluster, size_t begin, size_t end, float dt)
+{
+    for (size_t m = begin; m < end; m++){
+        uint32_t i = cluster.members[m];
+        Particle(particles, i).advance< RULES >(cluster.rules, flockSums[i], dt,
+                                                particles.nextPosition[i], particles.nextVelocity[i]);
+    }
 }
 
-void ParticleSystem::destroyParticle(Particle *particle)
+// Every particle reads the same read-only snapshot and writes only its own
+// slot of the back buffers, so the result doesn't depend on thread count
+// or order. Borders, flocking and integration are separate passes over all
+// particles, each timed as a whole; the last two go cluster by cluster,
+// switching to the pass for each cluster's rules once per thread chunk.
+void ParticleSystem::stepParallel(float dt)
 {
-    std::vector< Particle *>::const_iterator it = std::find(particles.begin(), particles.end(), particle);
-    delete * it;
-    particles.erase(it);
+    typedef uint64_t (ParticleSystem::* GatherPass)(const ParticleCluster &, size_t, size_t,
+                                                    NeighborScratch &);
+    typedef void (ParticleSystem::* AdvancePass)(const ParticleCluster &, size_t, size_t, float);
+    static const GatherPass gatherPasses[FLOCK_RULE_SETS] = RULE_SET_TABLE(gatherMembers);
+    static const AdvancePass advancePasses[FLOCK_RULE_SETS] = RULE_SET_TABLE(advanceMembers);
+
+    ThreadPool & pool = workers();
+    size_t count = particles.size();
 
-    for (auto spring : springs)
-        if (spring->particleA == * it || spring->particleB == * it)
-            destroySpring(spring);
+    particles.nextPosition.resize(count);
+    particles.nextVelocity.resize(count);
+    flockSums.resize(count);
+
+    {
+        ProfileTimer timer(profiler, PROFILE_BORDERS);
+        pool.parallelFor(count, [&](size_t, size_t begin, size_t end){
+            for (size_t i = begin; i < end; i++)
+                Particle(particles, i).bordered(world, particles.nextPosition[i], particles.nextVelocity[i]);
+        });
+    }
+
+    {
+        ProfileTimer timer(profiler, PROFILE_FLOCK);
+        pool.parallelFor(count, [&](size_t worker, size_t begin, size_t end){
+            uint64_t pairs = 0;
+            forClusterRanges(begin, end, [&](const ParticleCluster & cluster, size_t from, size_t to){
+                pairs += (this->*gatherPasses[cluster.rules.mask()])(cluster, from, to, workerScratch[worker]);
+            });
+            if (profiler)
+                profiler->count(PROFILE_NEIGHBOR_PAIRS, pairs);
+        });
+    }
+
+    {
+        ProfileTimer timer(profiler, PROFILE_INTEGRATE);
+        pool.parallelFor(count, [&](size_t, size_t begin, size_t end){
+            forClusterRanges(begin, end, [&](const ParticleCluster & cluster, size_t from, size_t to){
+                (this->*advancePasses[cluster.rules.mask()])(cluster, from, to, dt);
+            });
+        });
+    }
+
+    particles.swapBuffers();
 }
 
-void ParticleSystem::addSpring(Spring *spring)
+void ParticleSystem::setFlocking(bool enabled, float separationFactor,
+                                 float alignmentFactor, float cohesionFactor)
 {
-    springs.push_back(spring);
+    FlockingRules rules;
+    rules.separationEnabled = rules.alignmentEnabled = rules.cohesionEnabled = enabled;
+    rules.separationFactor = separationFactor;
+    rules.alignmentFactor = alignmentFactor;
+    rules.cohesionFactor = cohesionFactor;
+    setFlocking(rules);
 }
 
-void ParticleSystem::destroySpring(Spring *spring)
+void ParticleSystem::setFlocking(const FlockingRules & rules)
 {
-    std::vector<Spring*>::iterator it = std::find(springs.begin(), springs.end(), spring);
-    delete *it;
-    springs.erase(it);
+    flockingRules = rules;
+    for (auto & cluster : clusters)
+        cluster.rules = rules;
+}
+
+ClusterId ParticleSystem::clusterFor(const ci::Color & color)
+{
+    for (size_t c = 0; c < clusters.size(); c++)
+        if (clusters[c].color == color)
+            return (ClusterId)c;
+    clusters.push_back(ParticleCluster(color, flockingRules));
+    return (ClusterId)(clusters.size() - 1);
+}
+
+void ParticleSystem::recolor(const ci::Color & from, const ci::Color & to)
+{
+    size_t source = 0;
+    while (source < clusters.size() && clusters[source].color != from)
+        source++;
+    if (source == clusters.size() || from == to)
+        return;
+
+    size_t count = clusters.size();
+    ClusterId target = clusterFor(to);
+    if (clusters.size() > count)
+        clusters[target].rules = clusters[source].rules;
+
+    for (size_t i = 0; i < particles.size(); i++){
+        if (particles.cluster[i] == source){
+            particles.cluster[i] = target;
+            particles.color[i] = to;
+        }
+    }
+    gridStale = true;
+}
+
+void ParticleSystem::applyAttractor()
+{
+    if (! attractor.enabled)
+        return;
+
+    for (size_t i = 0; i < particles.size(); i++)
+        particles.forces[i] += attractor.force(particles.position[i]);
+}
+
+// Follows the borders, which resizes and rebakes the whole field
+void ParticleSystem::applyForceField()
+{
+    const ci::Rectf & borders = world.rect;
+    if (! forceField.enabled || ! world.bounded())
+        return;
+
+    const ci::Rectf & bounds = forceField.getBounds();
+    if (forceField.empty() || bounds.x1 != borders.x1 || bounds.y1 != borders.y1 ||
+        bounds.x2 != borders.x2 || bounds.y2 != borders.y2)
+        forceField.setBounds(borders, FORCE_FIELD_CELL_SIZE);
+    forceField.update(stepCount);
+
+    for (size_t i = 0; i < particles.size(); i++)
+        particles.forces[i] += forceField.sample(particles.position[i]);
+}
+
+// Sorts the particles into their clusters, drops the clusters left empty
+// and grids each of the others over just its members
+void ParticleSystem::rebuildGrid()
+{
+    for (auto & cluster : clusters)
+        cluster.members.clear();
+    for (size_t i = 0; i < particles.size(); i++)
+        clusters[particles.cluster[i]].members.push_back((uint32_t)i);
+
+    size_t kept = 0;
+    clusterRemap.resize(clusters.size());
+    for (size_t c = 0; c < clusters.size(); c++){
+        clusterRemap[c] = (ClusterId)kept;
+        if (clusters[c].members.empty())
+            continue;
+        if (kept != c)
+            std::swap(clusters[kept], clusters[c]);
+        kept++;
+    }
+    if (kept < clusters.size()){
+        clusters.erase(clusters.begin() + kept, clusters.end());
+        for (auto & cluster : particles.cluster)
+            cluster = clusterRemap[cluster];
+    }
+
+    clusterStart.resize(clusters.size() + 1);
+    clusterStart[0] = 0;
+    for (size_t c = 0; c < clusters.size(); c++){
+        ParticleCluster & cluster = clusters[c];
+        float cellSize = 0.f;
+        for (auto i : cluster.members)
+            cellSize = ci::math<float>::max(cellSize, particle(i).interactionRadius());
+        cluster.grid.build(particles.position, particles.velocity, cluster.members, cellSize, world);
+        clusterStart[c + 1] = clusterStart[c] + (uint32_t)cluster.members.size();
+    }
+
+    gridEntry.resize(particles.capacity());
+    for (auto & cluster : clusters)
+        for (size_t entry = 0; entry < cluster.members.size(); entry++)
+            gridEntry[cluster.grid.cellParticle((int)entry)] = (int)entry;
+
+    ungridded.clear();
+    gridStale = false;
+}
+
+// Drops the particle at `index` from its cluster's grid or the ungridded list
+void ParticleSystem::ungrid(uint32_t index)
+{
+    int entry = gridEntry[index];
+    if (entry >= 0)
+        clusters[particles.cluster[index]].grid.forgetEntry(entry);
+    else
+        ungridded.erase(std::find(ungridded.begin(), ungridded.end(), index));
+}
+
+// Files the particle at `from` under `to` there instead
+void ParticleSystem::regrid(uint32_t from, uint32_t to)
+{
+    int entry = gridEntry[from];
+    if (entry >= 0)
+        clusters[particles.cluster[from]].grid.renumberEntry(entry, to);
+    else
+        * std::find(ungridded.begin(), ungridded.end(), from) = to;
+    gridEntry[to] = entry;
+}
+
+void ParticleSystem::evictExcess()
+{
+    size_t limit = (size_t)ci::math<int>::max(maxParticles, 0);
+    if (particles.size() <= limit)
+        return;
+
+    size_t excess = particles.size() - limit;
+    if (evictionMode == EVICT_ONE_PER_FRAME)
+        excess = 1;
+
+    // Oldest first straight off the store's emission ring; each removal
+    // only touches the evicted particle's own springs.
+    while (excess-- > 0)
+        destroyParticle(particles.oldest());
+}
+
+ParticleHandle ParticleSystem::addParticle(const ci::Vec2f & position,
+                                           float radius, float mass, float drag,
+                                           float targetSeparation, float neighboringDistance,
+                                           const ci::Color & color)
+{
+    if (particles.full())
+        destroyParticle(particles.oldest());
+    size_t maxUngridded = ci::math<size_t>::max(MIN_UNGRIDDED, (size_t)ci::math<float>::sqrt((float)particles.size()));
+    if (gridStale || ungridded.size() > maxUngridded)
+        rebuildGrid();
+
+    ParticleHandle handle = particles.add(position, radius, mass, drag,
+                                          targetSeparation, neighboringDistance, color,
+                                          clusterFor(color));
+    connectSprings(handle);
+    ungridded.push_back((uint32_t)particles.indexOf(handle));
+    gridEntry[ungridded.back()] = -1;
+    return handle;
+}
+
+void ParticleSystem::addParticles(const std::vector< ParticleSpawn > & batch)
+{
+    for (auto & spawn : batch)
+        addParticle(spawn.position, spawn.radius, spawn.mass, spawn.drag,
+                    spawn.targetSeparation, spawn.neighboringDistance, spawn.color);
+}
+
+void ParticleSystem::connectSprings(ParticleHandle particle)
+{
+    chooseSprings(particle, chosenSprings);
+    for (auto & spring : chosenSprings)
+        addSpring(spring);
+}
+
+// Springs to the particle's k nearest neighbors in its cluster, nearest
+// first, found through the cluster's grid plus the particles added since
+// it was built. Only as many as the spring store has room for draw a
+// rest length and strength.
+void ParticleSystem::chooseSprings(ParticleHandle particle, std::vector< Spring > & chosen)
+{
+    size_t index = particles.indexOf(particle);
+    const ci::Vec2f position = particles.position[index];
+    ClusterId cluster = particles.cluster[index];
+    float radiusSq = springRadius * springRadius;
+
+    clusters[cluster].grid.query(position, springRadius, neighbors);
+    neighbors.insert(neighbors.end(), ungridded.begin(), ungridded.end());
+
+    springCandidates.clear();
+    for (auto other : neighbors){
+        if (particles.cluster[other] != cluster) continue;
+        float d2 = world.delta(position, particles.position[other]).lengthSquared();
+        if (d2 > 0.f && d2 < radiusSq)
+            springCandidates.push_back(std::make_pair(d2, other));
+    }
+
+    size_t count = std::min(springCandidates.size(),
+                            (size_t)ci::math<int>::max(springsPerParticle, 0));
+    std::partial_sort(springCandidates.begin(), springCandidates.begin() + count,
+                      springCandidates.end());
+    count = std::min(count, springs.capacity() - springs.size());
+
+    chosen.clear();
+    for (size_t i = 0; i < count; i++){
+        float d = ci::math<float>::sqrt(springCandidates[i].first);
+        chosen.push_back(Spring(particle, particles.handleAt(springCandidates[i].second),
+                                d * random.nextFloat(.4f, 1.8f),
+                                random.nextFloat(.0001f, .005f)));
+    }
+}
+
+void ParticleSystem::destroyParticle(ParticleHandle particle)
+{
+    if (! particles.isValid(particle))
+        return;
+
+    std::vector< SpringHandle > & attached = particleSprings[particle.index];
+    for (auto handle : attached){
+        const Spring & spring = springs[springs.indexOf(handle)];
+        ParticleHandle other = spring.particleA == particle ? spring.particleB : spring.particleA;
+        if (other != particle)
+            detachSpring(other, handle);
+        springs.remove(handle);
+    }
+    if (profiler)
+        profiler->count(PROFILE_SPRINGS_DESTROYED, attached.size());
+    attached.clear();
+
+    // Evicting at capacity for every emitted particle mustn't rebuild the
+    // grids each time, so they're patched instead
+    if (! gridStale){
+        uint32_t index = (uint32_t)particles.indexOf(particle);
+        uint32_t last = (uint32_t)particles.size() - 1;
+        ungrid(index);
+        if (last != index)
+            regrid(last, index);
+    }
+    particles.remove(particle);
+}
+
+SpringHandle ParticleSystem::addSpring(const Spring & spring, uint8_t color)
+{
+    SpringHandle handle = springs.add(spring, color);
+    if (springs.isValid(handle)){
+        particleSprings[spring.particleA.index].push_back(handle);
+        particleSprings[spring.particleB.index].push_back(handle);
+        if (profiler)
+            profiler->count(PROFILE_SPRINGS_CREATED);
+    }
+    return handle;
+}
+
+void ParticleSystem::destroySpring(SpringHandle spring)
+{
+    if (! springs.isValid(spring))
+        return;
+
+    const Spring & removed = springs[springs.indexOf(spring)];
+    detachSpring(removed.particleA, spring);
+    detachSpring(removed.particleB, spring);
+    springs.remove(spring);
+    if (profiler)
+        profiler->count(PROFILE_SPRINGS_DESTROYED);
+}
+
+void ParticleSystem::detachSpring(ParticleHandle particle, SpringHandle spring)
+{
+    std::vector< SpringHandle > & attached = particleSprings[particle.index];
+    for (size_t i = 0; i < attached.size(); i++){
+        if (attached[i] == spring){
+            attached[i] = attached.back();
+            attached.pop_back();
+            return;
+        }
+    }
 }
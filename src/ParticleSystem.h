@@ -1,35 +1,245 @@
 #pragma once
 
+#include "cinder/Rect.h"
+#include "cinder/Rand.h"
+
 #include "Particle.h"
 #include "Spring.h"
+#include "SpatialGrid.h"
+#include "ParticleCluster.h"
+#include "ThreadPool.h"
+#include "Profiler.h"
+#include "ForceField.h"
+#include "TrailStore.h"
 
 #include <vector>
+#include <memory>
+#include <functional>
 
 #define MAX_PARTICLES   200
 
+struct ParticleSpawn {
+
+    ParticleSpawn() {};
+    ParticleSpawn(const ci::Vec2f & position,
+                  float radius, float mass, float drag,
+                  float targetSeparation,
+                  float neighboringDistance,
+                  const ci::Color & color) :
+        position(position), radius(radius), mass(mass), drag(drag),
+        targetSeparation(targetSeparation),
+        neighboringDistance(neighboringDistance),
+        color(color) {};
+
+    ci::Vec2f   position;
+    float       radius, mass, drag;
+    float       targetSeparation, neighboringDistance;
+    ci::Color   color;
+};
+
+enum EvictionMode {
+    EVICT_ONE_PER_FRAME,    // drop at most the oldest particle each update
+    EVICT_EXCESS_FIFO       // drop every particle above maxParticles, oldest first
+};
+
 class ParticleSystem {
 
-    ci::Area        borders;
-    ci::BSpline2f   spline;
+    WorldBounds     world;
+    double          accumulator;
+
+    ci::Rand        random;
+    uint32_t        randomSeed;
+
+    std::vector< ParticleCluster >  clusters;
+    FlockingRules                   flockingRules;
+    std::vector< ClusterId >        clusterRemap;
+
+    // Where each cluster's members start with all clusters' members laid
+    // end to end, the order the flocking passes walk particles in
+    std::vector< uint32_t >         clusterStart;
+    std::vector< uint32_t >         neighbors;
+
+    // Particles added since the cluster grids were built, and each
+    // particle's entry in its cluster's grid, -1 for those. Removal moves
+    // the last particle into the freed index, which destroyParticle()
+    // patches into both; anything else reordering the dense arrays makes
+    // the grids stale.
+    std::vector< uint32_t >     ungridded;
+    std::vector< int >          gridEntry;
+    bool                        gridStale;
+
+    std::vector< std::pair< float, uint32_t > > springCandidates;
+    std::vector< Spring >                       chosenSprings;
+
+    // A neighbor as canonicalOrder sorts them, shifted next to the
+    // particle it neighbors
+    struct FlockNeighbor {
+        float   x, y, vx, vy;
+        bool operator<(const FlockNeighbor & other) const;
+    };
+
+    // Each worker's scratch for gathering a particle's neighbors
+    struct NeighborScratch {
+        std::vector< GridSpan >         spans;
+        std::vector< FlockNeighbor >    sorted;
+        std::vector< float >            x, y, vx, vy;
+    };
+
+    std::unique_ptr< ThreadPool >               threadPool;
+    std::vector< NeighborScratch >              workerScratch;
+    std::vector< FlockSums >                    flockSums;
+
+    // Springs attached to each particle, indexed by particle handle slot
+    std::vector< std::vector< SpringHandle > >  particleSprings;
+
+    void detachSpring(ParticleHandle particle, SpringHandle spring);
+    void evictExcess();
+    void applyAttractor();
+    void applyForceField();
+    void rebuildGrid();
+    void ungrid(uint32_t index);
+    void regrid(uint32_t from, uint32_t to);
+    ThreadPool & workers();
+    void stepSerial(float dt);
+    void stepParallel(float dt);
+
+    // Per cluster passes, one instantiation per rule set and picked by
+    // the cluster's FlockingRules::mask() once per step
+    template< unsigned RULES >
+    uint64_t stepClusterSerial(const ParticleCluster & cluster, float dt);
+    template< unsigned RULES >
+    uint64_t gatherMembers(const ParticleCluster & cluster, size_t begin, size_t end,
+                           NeighborScratch & scratch);
+    template< unsigned RULES >
+    void accumulateSorted(const SpatialGrid & grid, const Particle & particle,
+                          NeighborScratch & scratch, FlockSums & sums);
+    template< unsigned RULES >
+    void advanceMembers(const ParticleCluster & cluster, size_t begin, size_t end, float dt);
+    template< typename Pass >
+    void forClusterRanges(size_t begin, size_t end, const Pass & pass) const;
+    void connectSprings(ParticleHandle particle);
 
 public:
 
-    ~ParticleSystem();
+    ParticleSystem();
 
+    int update(double elapsedSeconds);
     void update();
-    void draw();
+    void updateParticles(float dt = 1.f);
+    void updateSprings(float dt = 1.f);
+
+    float getInterpolation() const;
+    void interpolatePositions(std::vector< ci::Vec2f > & positions) const;
 
-    void addParticle(Particle * particle);
-    void destroyParticle(Particle * particle);
+    void setCapacity(size_t particleCapacity, size_t springCapacity);
+
+    // Particles bounce off these once set, or wrap around them in a
+    // periodic world; a system without borders is unbounded
+    void setBorders(const ci::Rectf & borders) { world.rect = borders; };
+    const ci::Rectf & getBorders() const { return world.rect; };
+    void setPeriodic(bool periodic) { world.periodic = periodic; };
+    bool isPeriodic() const { return world.periodic; };
+    const WorldBounds & getWorld() const { return world; };
+
+    // Rules of every cluster, and of those created from now on
+    void setFlocking(bool enabled, float separationFactor,
+                     float alignmentFactor, float cohesionFactor);
+    void setFlocking(const FlockingRules & rules);
+    const FlockingRules & getFlocking() const { return flockingRules; };
+
+    // The cluster of particles with this color, created if there's none.
+    // Clusters left without particles are dropped, and the others
+    // renumbered, whenever the grids are rebuilt.
+    ClusterId clusterFor(const ci::Color & color);
+    size_t clusterCount() const { return clusters.size(); };
+    ParticleCluster & cluster(ClusterId id) { return clusters[id]; };
+    const ParticleCluster & cluster(ClusterId id) const { return clusters[id]; };
+
+    // Repaints every particle of color `from`; they join the cluster of
+    // `to`, or take their rules along into a new one
+    void recolor(const ci::Color & from, const ci::Color & to);
+
+    ParticleHandle addParticle(const ci::Vec2f & position,
+                               float radius, float mass, float drag,
+                               float targetSeparation,
+                               float neighboringDistance,
+                               const ci::Color & color);
+    void addParticles(const std::vector< ParticleSpawn > & batch);
+    void destroyParticle(ParticleHandle particle);
     void clear();
 
-    void addSpring(Spring * spring);
-    void destroySpring(Spring * spring);
+    // The springs a new particle gets when added, for adding them later
+    // with colors of one's own
+    void chooseSprings(ParticleHandle particle, std::vector< Spring > & chosen);
+
+    SpringHandle addSpring(const Spring & spring, uint8_t color = SPRING_ANY_COLOR);
+    void destroySpring(SpringHandle spring);
+    const std::vector< SpringHandle > & attachedSprings(ParticleHandle particle) const {
+        return particleSprings[particle.index];
+    };
+
+    Particle particle(size_t index) { return Particle(particles, index); };
+    Particle particle(ParticleHandle handle) { return Particle(particles, particles.indexOf(handle)); };
+
+    // Exact per particle; further attractors go in the force field
+    Attractor       attractor;
+
+    // Curl noise and extra attractors, baked over the borders and read
+    // back per particle; needs borders
+    ForceField      forceField;
+
+    // Steps taken since construction or the last restored snapshot
+    uint64_t        stepCount;
+
+    // Source of the random spring lengths and strengths; reseeding it
+    // along with a snapshot makes what follows reproducible
+    void reseed(uint32_t seed) { randomSeed = seed; random.seed(seed); };
+    uint32_t getSeed() const { return randomSeed; };
+
+    // update(elapsedSeconds) advances in fixed steps of timeStep seconds,
+    // each integrated in `substeps` passes, catching up at most
+    // maxStepsPerUpdate steps per call
+    float           timeStep;
+    int             substeps;
+    int             maxStepsPerUpdate;
+
+    int             maxParticles;
+    EvictionMode    evictionMode;
+
+    // Advance all particles from a snapshot of the previous frame across a
+    // thread pool, instead of one after another on the calling thread
+    bool            parallelStep;
+
+    // Threads of that pool, taken when it's first needed; 0 is one per core
+    size_t          workerThreads;
+
+    // The parallel step adds up each particle's flocking sums over its
+    // neighbors sorted by position and velocity rather than in grid order,
+    // so they only depend on which neighbors it has and not on how the
+    // particles are stored; slower. Runs split over tiles need it to match
+    // one process.
+    bool            canonicalOrder;
+
+    // New particles spring to at most this many of their nearest
+    // neighbors in the same cluster within springRadius
+    int             springsPerParticle;
+    float           springRadius;
+
+    // Relaxation passes over all springs per substep; more is stiffer
+    int             springIterations;
+
+    // Relaxes the springs in each substep instead of SpringStore::update()
+    // when set, as TileSimulation does to bring in the ends other
+    // processes move between colors
+    std::function< void (float dt) >   springPass;
 
-    void computeBspline();
+    ParticleStore   particles;
+    SpringStore     springs;
 
-    int  maxParticles;
+    // Recent positions of every particle, recorded after each step once
+    // given a length; sized along with the particles
+    TrailStore      trails;
 
-    std::vector< Particle * >   particles;
-    std::vector< Spring * >     springs;
+    // Phase times and counters go here when set; not owned
+    Profiler *      profiler;
 };
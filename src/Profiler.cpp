@@ -0,0 +1,131 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+
+Profiler::Profiler(size_t window) : window(std::max< size_t >(window, 1))
+{
+    phaseHistory.resize(this->window * PROFILE_PHASE_COUNT);
+    counterHistory.resize(this->window * PROFILE_COUNTER_COUNT);
+    sorted.reserve(this->window);
+    csv = NULL;
+    enabled = true;
+    reset();
+}
+
+Profiler::~Profiler()
+{
+    closeCsv();
+}
+
+void Profiler::reset()
+{
+    frames = 0;
+    std::fill(phaseNanos, phaseNanos + PROFILE_PHASE_COUNT, 0);
+    for (int i = 0; i < PROFILE_COUNTER_COUNT; i++){
+        counters[i] = 0;
+        lastCounters[i] = 0;
+    }
+}
+
+void Profiler::endFrame()
+{
+    if (! enabled)
+        return;
+
+    size_t slot = frames % window;
+    for (int i = 0; i < PROFILE_PHASE_COUNT; i++){
+        phaseHistory[slot * PROFILE_PHASE_COUNT + i] = phaseNanos[i] * 1e-6f;
+        phaseNanos[i] = 0;
+    }
+    for (int i = 0; i < PROFILE_COUNTER_COUNT; i++){
+        lastCounters[i] = counters[i].exchange(0, std::memory_order_relaxed);
+        counterHistory[slot * PROFILE_COUNTER_COUNT + i] = (float)lastCounters[i];
+    }
+
+    if (csv){
+        fprintf(csv, "%zu", frames);
+        for (int i = 0; i < PROFILE_PHASE_COUNT; i++)
+            fprintf(csv, ",%.4f", phaseHistory[slot * PROFILE_PHASE_COUNT + i]);
+        for (int i = 0; i < PROFILE_COUNTER_COUNT; i++)
+            fprintf(csv, ",%llu", (unsigned long long)lastCounters[i]);
+        fputc('\n', csv);
+    }
+    frames++;
+}
+
+float Profiler::percentileOf(const std::vector< float > & history, size_t column,
+                             size_t columns, float fraction) const
+{
+    size_t count = std::min(frames, window);
+    if (count == 0)
+        return 0.f;
+
+    sorted.clear();
+    for (size_t i = 0; i < count; i++)
+        sorted.push_back(history[i * columns + column]);
+
+    size_t rank = (size_t)std::floor(std::min(std::max(fraction, 0.f), 1.f) * (count - 1) + .5f);
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank];
+}
+
+float Profiler::phasePercentile(ProfilePhase phase, float fraction) const
+{
+    return percentileOf(phaseHistory, phase, PROFILE_PHASE_COUNT, fraction);
+}
+
+float Profiler::counterPercentile(ProfileCounter counter, float fraction) const
+{
+    return percentileOf(counterHistory, counter, PROFILE_COUNTER_COUNT, fraction);
+}
+
+// Phase columns are milliseconds, counter columns plain counts; the file is
+// left buffered by stdio, so a row costs no system call
+bool Profiler::openCsv(const std::string & path)
+{
+    closeCsv();
+    csv = fopen(path.c_str(), "w");
+    if (! csv)
+        return false;
+
+    fprintf(csv, "frame");
+    for (int i = 0; i < PROFILE_PHASE_COUNT; i++)
+        fprintf(csv, ",%s_ms", phaseName((ProfilePhase)i));
+    for (int i = 0; i < PROFILE_COUNTER_COUNT; i++)
+        fprintf(csv, ",%s", counterName((ProfileCounter)i));
+    fputc('\n', csv);
+    return true;
+}
+
+void Profiler::closeCsv()
+{
+    if (csv)
+        fclose(csv);
+    csv = NULL;
+}
+
+uint64_t Profiler::now()
+{
+    return std::chrono::duration_cast< std::chrono::nanoseconds >(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char * Profiler::phaseName(ProfilePhase phase)
+{
+    static const char * names[PROFILE_PHASE_COUNT] = {
+        "eviction", "attraction", "field", "grid", "borders", "integrate",
+        "flock", "springs", "update", "trails", "lines", "sprites", "draw"
+    };
+    return names[phase];
+}
+
+const char * Profiler::counterName(ProfileCounter counter)
+{
+    static const char * names[PROFILE_COUNTER_COUNT] = {
+        "neighbor_pairs", "line_pairs", "springs_created", "springs_destroyed", "draw_calls"
+    };
+    return names[counter];
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+enum ProfilePhase {
+    PROFILE_EVICTION,
+    PROFILE_ATTRACTION,
+    PROFILE_FIELD,
+    PROFILE_GRID,
+    PROFILE_BORDERS,
+    PROFILE_INTEGRATE,
+    PROFILE_FLOCK,          // the serial step includes borders and integration
+    PROFILE_SPRINGS,
+    PROFILE_UPDATE,         // all of ClimaxApp::update()
+    PROFILE_TRAILS,
+    PROFILE_LINES,
+    PROFILE_SPRITES,
+    PROFILE_DRAW,           // all of ClimaxApp::draw()
+    PROFILE_PHASE_COUNT
+};
+
+enum ProfileCounter {
+    PROFILE_NEIGHBOR_PAIRS,     // particle pairs tested for flocking
+    PROFILE_LINE_PAIRS,         // particle pairs tested for connection lines
+    PROFILE_SPRINGS_CREATED,
+    PROFILE_SPRINGS_DESTROYED,
+    PROFILE_DRAW_CALLS,
+    PROFILE_COUNTER_COUNT
+};
+
+// Per-frame phase times and event counts, kept over a rolling window of
+// frames for percentiles and optionally appended to a CSV file, one row per
+// frame.
+//
+// Times are added by whoever runs the phase on the calling thread; counters
+// may be bumped from any thread. Everything but the clock reads is skipped
+// while disabled.
+class Profiler {
+
+    std::vector< float >    phaseHistory;
+    std::vector< float >    counterHistory;
+    size_t                  window;
+    size_t                  frames;
+
+    uint64_t                        phaseNanos[PROFILE_PHASE_COUNT];
+    std::atomic< uint64_t >         counters[PROFILE_COUNTER_COUNT];
+    uint64_t                        lastCounters[PROFILE_COUNTER_COUNT];
+
+    mutable std::vector< float >    sorted;
+
+    FILE *                  csv;
+
+    float percentileOf(const std::vector< float > & history, size_t column,
+                       size_t columns, float fraction) const;
+
+public:
+
+    explicit Profiler(size_t window = 120);
+    ~Profiler();
+
+    void addTime(ProfilePhase phase, uint64_t nanos) { phaseNanos[phase] += nanos; };
+    void count(ProfileCounter counter, uint64_t amount = 1) {
+        counters[counter].fetch_add(amount, std::memory_order_relaxed);
+    };
+
+    // Closes the current frame: moves its times and counts into the window
+    // and the CSV file, and starts the next one from zero
+    void endFrame();
+    void reset();
+
+    // Over the frames in the window, in milliseconds for phases
+    float phasePercentile(ProfilePhase phase, float fraction) const;
+    float counterPercentile(ProfileCounter counter, float fraction) const;
+    uint64_t lastCount(ProfileCounter counter) const { return lastCounters[counter]; };
+    size_t frameCount() const { return frames; };
+
+    bool openCsv(const std::string & path);
+    void closeCsv();
+    bool recording() const { return csv != NULL; };
+
+    static uint64_t now();
+    static const char * phaseName(ProfilePhase phase);
+    static const char * counterName(ProfileCounter counter);
+
+    bool enabled;
+};
+
+// Adds the time until it goes out of scope to a phase; a null or disabled
+// profiler doesn't even read the clock
+class ProfileTimer {
+
+    Profiler *      profiler;
+    ProfilePhase    phase;
+    uint64_t        start;
+
+public:
+
+    ProfileTimer(Profiler * profiler, ProfilePhase phase) :
+        profiler(profiler && profiler->enabled ? profiler : NULL), phase(phase),
+        start(this->profiler ? Profiler::now() : 0) {};
+    ~ProfileTimer() {
+        if (profiler)
+            profiler->addTime(phase, Profiler::now() - start);
+    };
+};
@@ -0,0 +1,472 @@
+#include "Recording.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define DEFAULT_SNAPSHOT_INTERVAL   300
+#define FILE_HEADER_SIZE            8
+#define RECORD_HEADER_SIZE          16
+#define TRAILER_SIZE                12
+
+// Offset of the random seed inside a snapshot, see writeSnapshot()
+#define SNAPSHOT_SEED_OFFSET        16
+
+static void putSpawn(ByteWriter & out, const ParticleSpawn & spawn)
+{
+    out.put(spawn.position);
+    out.put(spawn.radius);
+    out.put(spawn.mass);
+    out.put(spawn.drag);
+    out.put(spawn.targetSeparation);
+    out.put(spawn.neighboringDistance);
+    out.put(spawn.color.r); out.put(spawn.color.g); out.put(spawn.color.b);
+}
+
+static bool getSpawn(ByteReader & in, ParticleSpawn & spawn)
+{
+    in.get(spawn.position);
+    in.get(spawn.radius);
+    in.get(spawn.mass);
+    in.get(spawn.drag);
+    in.get(spawn.targetSeparation);
+    in.get(spawn.neighboringDistance);
+    in.get(spawn.color.r); in.get(spawn.color.g); in.get(spawn.color.b);
+    return in.ok();
+}
+
+static void putControls(ByteWriter & out, const RecordedControls & controls)
+{
+    out.put((uint8_t)controls.flocking);
+    out.put(controls.separationFactor);
+    out.put(controls.alignmentFactor);
+    out.put(controls.cohesionFactor);
+    out.put(controls.attractionCenter);
+    out.put(controls.forceCenter);
+    out.put(controls.borders.x1); out.put(controls.borders.y1);
+    out.put(controls.borders.x2); out.put(controls.borders.y2);
+    out.put((int32_t)controls.maxParticles);
+    out.put((uint8_t)controls.flowField);
+    out.put(controls.flowStrength);
+    out.put(controls.flowScale);
+    out.put(controls.flowSpeed);
+    out.put((uint8_t)controls.periodic);
+}
+
+static bool getControls(ByteReader & in, RecordedControls & controls)
+{
+    uint8_t flocking = 0;
+    int32_t maxParticles = 0;
+    in.get(flocking);
+    in.get(controls.separationFactor);
+    in.get(controls.alignmentFactor);
+    in.get(controls.cohesionFactor);
+    in.get(controls.attractionCenter);
+    in.get(controls.forceCenter);
+    in.get(controls.borders.x1); in.get(controls.borders.y1);
+    in.get(controls.borders.x2); in.get(controls.borders.y2);
+    in.get(maxParticles);
+    controls.flocking = flocking != 0;
+    controls.maxParticles = maxParticles;
+    if (! in.ok())
+        return false;
+
+    // Version 1 stops here and ran without a force field, version 2 after
+    // it and never wrapped around
+    uint8_t flowField = 0;
+    if (in.get(flowField)){
+        in.get(controls.flowStrength);
+        in.get(controls.flowScale);
+        in.get(controls.flowSpeed);
+        controls.flowField = flowField != 0;
+        if (! in.ok())
+            return false;
+
+        uint8_t periodic = 0;
+        if (in.get(periodic))
+            controls.periodic = periodic != 0;
+    }
+    return true;
+}
+
+bool RecordedControls::operator==(const RecordedControls & other) const
+{
+    return flocking == other.flocking &&
+           separationFactor == other.separationFactor &&
+           alignmentFactor == other.alignmentFactor &&
+           cohesionFactor == other.cohesionFactor &&
+           attractionCenter == other.attractionCenter &&
+           forceCenter == other.forceCenter &&
+           borders.x1 == other.borders.x1 && borders.y1 == other.borders.y1 &&
+           borders.x2 == other.borders.x2 && borders.y2 == other.borders.y2 &&
+           maxParticles == other.maxParticles &&
+           flowField == other.flowField &&
+           flowStrength == other.flowStrength &&
+           flowScale == other.flowScale &&
+           flowSpeed == other.flowSpeed &&
+           periodic == other.periodic;
+}
+
+void RecordedControls::apply(ParticleSystem & system, SceneState & scene) const
+{
+    system.setFlocking(flocking, separationFactor, alignmentFactor, cohesionFactor);
+    system.attractor.center = attractionCenter;
+    system.maxParticles = maxParticles;
+    system.setBorders(borders);
+    system.setPeriodic(periodic);
+    scene.forceCenter = forceCenter;
+
+    ForceField & field = system.forceField;
+    if (field.noiseStrength != flowStrength || field.noiseScale != flowScale ||
+        field.noiseSpeed != flowSpeed)
+        field.invalidate();
+    field.enabled = flowField;
+    field.noiseStrength = flowStrength;
+    field.noiseScale = flowScale;
+    field.noiseSpeed = flowSpeed;
+}
+
+// Recorder
+
+Recorder::Recorder()
+{
+    file = NULL;
+    snapshotInterval = DEFAULT_SNAPSHOT_INTERVAL;
+    quantize = false;
+    controlsWritten = false;
+    lastSnapshotStep = 0;
+    currentStep = 0;
+}
+
+Recorder::~Recorder()
+{
+    close();
+}
+
+bool Recorder::open(const std::string & path)
+{
+    close();
+    file = fopen(path.c_str(), "wb");
+    if (! file)
+        return false;
+
+    uint32_t header[2] = { RECORDING_MAGIC, RECORDING_VERSION };
+    fwrite(header, sizeof(header), 1, file);
+    snapshots.clear();
+    controlsWritten = false;
+    currentStep = 0;
+    return true;
+}
+
+// Writes the snapshot index and the trailer pointing at it
+void Recorder::close()
+{
+    if (! file)
+        return;
+
+    uint64_t indexOffset = (uint64_t)ftell(file);
+
+    buffer.clear();
+    ByteWriter out(buffer);
+    out.put((uint32_t)snapshots.size());
+    for (auto & snapshot : snapshots){
+        out.put(snapshot.first);
+        out.put(snapshot.second);
+    }
+    writeRecord(RECORD_INDEX, currentStep);
+
+    buffer.clear();
+    out.put(indexOffset);
+    out.put((uint32_t)RECORDING_TRAILER);
+    fwrite(buffer.data(), 1, buffer.size(), file);
+
+    fclose(file);
+    file = NULL;
+}
+
+void Recorder::writeRecord(RecordType type, uint64_t step)
+{
+    uint32_t header[2] = { (uint32_t)type, (uint32_t)buffer.size() };
+    fwrite(header, sizeof(header), 1, file);
+    fwrite(&step, sizeof(step), 1, file);
+    if (! buffer.empty())
+        fwrite(buffer.data(), 1, buffer.size(), file);
+}
+
+void Recorder::recordFrame(ParticleSystem & system, const SceneState & scene)
+{
+    if (! file)
+        return;
+
+    uint64_t step = system.stepCount;
+    currentStep = step;
+    if (! snapshots.empty() && step < lastSnapshotStep + (uint64_t)std::max(snapshotInterval, 1))
+        return;
+
+    system.reseed((uint32_t)(step * 2654435761u));
+    buffer.clear();
+    writeSnapshot(buffer, system, scene, quantize);
+
+    snapshots.push_back(std::make_pair(step, (uint64_t)ftell(file)));
+    writeRecord(RECORD_SNAPSHOT, step);
+    lastSnapshotStep = step;
+
+    // A replay starting here needs the controls as well
+    controlsWritten = false;
+}
+
+void Recorder::recordSpawn(const ParticleSystem & system, const ParticleSpawn & spawn)
+{
+    if (! file)
+        return;
+
+    buffer.clear();
+    ByteWriter out(buffer);
+    putSpawn(out, spawn);
+    writeRecord(RECORD_SPAWN, system.stepCount);
+}
+
+void Recorder::recordClear(const ParticleSystem & system)
+{
+    if (! file)
+        return;
+
+    buffer.clear();
+    writeRecord(RECORD_CLEAR, system.stepCount);
+}
+
+void Recorder::recordRecolor(const ParticleSystem & system, const ci::Color & from, const ci::Color & to)
+{
+    if (! file)
+        return;
+
+    buffer.clear();
+    ByteWriter out(buffer);
+    out.put(from.r); out.put(from.g); out.put(from.b);
+    out.put(to.r); out.put(to.g); out.put(to.b);
+    writeRecord(RECORD_RECOLOR, system.stepCount);
+}
+
+void Recorder::recordControls(const ParticleSystem & system, const RecordedControls & controls)
+{
+    if (! file || (controlsWritten && controls == this->controls))
+        return;
+
+    buffer.clear();
+    ByteWriter out(buffer);
+    putControls(out, controls);
+    writeRecord(RECORD_CONTROLS, system.stepCount);
+    this->controls = controls;
+    controlsWritten = true;
+}
+
+// Player
+
+Player::Player()
+{
+    data = NULL;
+    size = 0;
+    descriptor = -1;
+    cursor = 0;
+    endStep = 0;
+}
+
+Player::~Player()
+{
+    close();
+}
+
+bool Player::open(const std::string & path)
+{
+    close();
+
+    descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(descriptor, &info) != 0 || info.st_size < FILE_HEADER_SIZE){
+        close();
+        return false;
+    }
+
+    void * mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    if (mapped == MAP_FAILED){
+        close();
+        return false;
+    }
+    data = (const uint8_t *)mapped;
+    size = (size_t)info.st_size;
+
+    uint32_t header[2];
+    memcpy(header, data, sizeof(header));
+    if (header[0] != RECORDING_MAGIC || header[1] > RECORDING_VERSION){
+        close();
+        return false;
+    }
+
+    if (! readIndex())
+        scanRecords();
+    cursor = size;
+    return ! snapshots.empty();
+}
+
+void Player::close()
+{
+    if (data)
+        munmap((void *)data, size);
+    if (descriptor >= 0)
+        ::close(descriptor);
+    data = NULL;
+    size = 0;
+    descriptor = -1;
+    snapshots.clear();
+    cursor = 0;
+    endStep = 0;
+}
+
+bool Player::readHeader(size_t offset, RecordHeader & header) const
+{
+    if (offset > size || size - offset < RECORD_HEADER_SIZE)
+        return false;
+    memcpy(&header.type, data + offset, 4);
+    memcpy(&header.size, data + offset + 4, 4);
+    memcpy(&header.step, data + offset + 8, 8);
+    return size - offset - RECORD_HEADER_SIZE >= header.size;
+}
+
+// The trailer of a cleanly closed file points at the snapshot index
+bool Player::readIndex()
+{
+    if (size < FILE_HEADER_SIZE + TRAILER_SIZE)
+        return false;
+
+    ByteReader trailer(data + size - TRAILER_SIZE, TRAILER_SIZE);
+    uint64_t indexOffset;
+    uint32_t magic;
+    trailer.get(indexOffset);
+    trailer.get(magic);
+
+    RecordHeader header;
+    if (magic != RECORDING_TRAILER || ! readHeader((size_t)indexOffset, header) ||
+        header.type != RECORD_INDEX)
+        return false;
+
+    ByteReader index(data + indexOffset + RECORD_HEADER_SIZE, header.size);
+    uint32_t count = 0;
+    index.get(count);
+    snapshots.clear();
+    for (uint32_t i = 0; i < count; i++){
+        std::pair< uint64_t, uint64_t > snapshot;
+        if (! (index.get(snapshot.first) && index.get(snapshot.second)))
+            return false;
+        snapshots.push_back(snapshot);
+    }
+    endStep = header.step;
+    return true;
+}
+
+// For files that were never closed: hops over the payloads and drops a
+// last record cut short
+void Player::scanRecords()
+{
+    snapshots.clear();
+    endStep = 0;
+
+    RecordHeader header;
+    size_t offset = FILE_HEADER_SIZE;
+    while (readHeader(offset, header) && header.type != RECORD_INDEX){
+        if (header.type == RECORD_SNAPSHOT)
+            snapshots.push_back(std::make_pair(header.step, (uint64_t)offset));
+        endStep = std::max(endStep, header.step);
+        offset += RECORD_HEADER_SIZE + header.size;
+    }
+}
+
+bool Player::seek(uint64_t step, ParticleSystem & system, SceneState & scene)
+{
+    if (snapshots.empty())
+        return false;
+
+    auto after = std::upper_bound(snapshots.begin(), snapshots.end(),
+                                  std::make_pair(step, UINT64_MAX));
+    if (after == snapshots.begin())
+        return false;
+    size_t offset = (size_t)(after - 1)->second;
+
+    RecordHeader header;
+    if (! readHeader(offset, header) || header.type != RECORD_SNAPSHOT ||
+        ! readSnapshot(data + offset + RECORD_HEADER_SIZE, header.size, system, scene))
+        return false;
+
+    cursor = offset + RECORD_HEADER_SIZE + header.size;
+    while (system.stepCount < step && this->step(system, scene))
+        ;
+    return system.stepCount == step;
+}
+
+// Everything tagged with the system's current step, in file order
+void Player::applyRecords(ParticleSystem & system, SceneState & scene)
+{
+    RecordHeader header;
+    while (readHeader(cursor, header) && header.step <= system.stepCount){
+        ByteReader in(data + cursor + RECORD_HEADER_SIZE, header.size);
+        cursor += RECORD_HEADER_SIZE + header.size;
+        if (header.step < system.stepCount)
+            continue;
+
+        switch (header.type){
+            case RECORD_SPAWN: {
+                ParticleSpawn spawn;
+                if (getSpawn(in, spawn))
+                    system.addParticle(spawn.position, spawn.radius, spawn.mass, spawn.drag,
+                                       spawn.targetSeparation, spawn.neighboringDistance, spawn.color);
+                break;
+            }
+            case RECORD_CLEAR:
+                system.clear();
+                break;
+            case RECORD_CONTROLS: {
+                RecordedControls controls;
+                if (getControls(in, controls))
+                    controls.apply(system, scene);
+                break;
+            }
+            case RECORD_RECOLOR: {
+                ci::Color from, to;
+                in.get(from.r); in.get(from.g); in.get(from.b);
+                in.get(to.r); in.get(to.g); in.get(to.b);
+                if (in.ok())
+                    system.recolor(from, to);
+                break;
+            }
+            case RECORD_SNAPSHOT: {
+                // Already in this state, but the recorder reseeded here
+                uint32_t seed;
+                ByteReader snapshot(data + cursor - header.size + SNAPSHOT_SEED_OFFSET,
+                                    header.size - SNAPSHOT_SEED_OFFSET);
+                if (header.size > SNAPSHOT_SEED_OFFSET && snapshot.get(seed))
+                    system.reseed(seed);
+                break;
+            }
+            default:
+                cursor = size;
+                return;
+        }
+    }
+}
+
+bool Player::step(ParticleSystem & system, SceneState & scene)
+{
+    if (! data)
+        return false;
+
+    applyRecords(system, scene);
+    if (system.stepCount >= endStep)
+        return false;
+    system.update();
+    return true;
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "cinder/Vector.h"
+#include "cinder/Rect.h"
+
+#include "ParticleSystem.h"
+#include "Snapshot.h"
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+// A recording is a file header followed by records, each a small header
+// plus payload: full snapshots every few hundred steps and, in between,
+// the input that reached the system before each step. Closing the file
+// appends an index of the snapshots and a trailer pointing at it; a file
+// cut off by a crash has neither and is indexed by hopping from record
+// header to record header instead.
+
+#define RECORDING_MAGIC     0x43455243  // "CREC"
+#define RECORDING_VERSION   3
+#define RECORDING_TRAILER   0x58444943  // "CIDX"
+
+enum RecordType {
+    RECORD_SNAPSHOT,
+    RECORD_SPAWN,       // ParticleSpawn
+    RECORD_CLEAR,
+    RECORD_CONTROLS,    // RecordedControls
+    RECORD_INDEX,
+    RECORD_RECOLOR      // color from, color to
+};
+
+// Per-frame settings the app pushes into the system
+struct RecordedControls {
+
+    RecordedControls() :
+        flocking(false), separationFactor(0.f), alignmentFactor(0.f), cohesionFactor(0.f),
+        attractionCenter(ci::Vec2f::zero()), forceCenter(ci::Vec2f::zero()),
+        maxParticles(0),
+        flowField(false), flowStrength(0.f), flowScale(0.f), flowSpeed(0.f),
+        periodic(false) {};
+
+    bool operator==(const RecordedControls & other) const;
+    bool operator!=(const RecordedControls & other) const { return !(* this == other); };
+
+    void apply(ParticleSystem & system, SceneState & scene) const;
+
+    bool        flocking;
+    float       separationFactor, alignmentFactor, cohesionFactor;
+    ci::Vec2f   attractionCenter, forceCenter;
+    ci::Rectf   borders;
+    int         maxParticles;
+
+    // Force field settings, added in version 2
+    bool        flowField;
+    float       flowStrength, flowScale, flowSpeed;
+
+    // Whether the world wraps around the borders, added in version 3
+    bool        periodic;
+};
+
+// Appends to a recording while the app runs. Everything is tagged with
+// the system's step count, so the input lands before the same step on
+// replay however frames and steps lined up originally.
+class Recorder {
+
+    FILE *                  file;
+    std::vector< uint8_t >  buffer;
+    std::vector< std::pair< uint64_t, uint64_t > > snapshots;     // (step, offset)
+
+    RecordedControls        controls;
+    bool                    controlsWritten;
+    uint64_t                lastSnapshotStep;
+    uint64_t                currentStep;
+
+    void writeRecord(RecordType type, uint64_t step);
+
+public:
+
+    Recorder();
+    ~Recorder();
+
+    bool open(const std::string & path);
+    void close();
+    bool isOpen() const { return file != NULL; };
+
+    // Call once before each frame's steps; writes a snapshot when one is
+    // due, which also reseeds the system so replays from it line up
+    void recordFrame(ParticleSystem & system, const SceneState & scene);
+
+    void recordSpawn(const ParticleSystem & system, const ParticleSpawn & spawn);
+    void recordClear(const ParticleSystem & system);
+    void recordRecolor(const ParticleSystem & system, const ci::Color & from, const ci::Color & to);
+    void recordControls(const ParticleSystem & system, const RecordedControls & controls);
+
+    // Steps between snapshots
+    int     snapshotInterval;
+    bool    quantize;
+};
+
+// Memory-maps a recording and replays it. Seeking restores the closest
+// snapshot at or before the target and steps forward from there, reading
+// only the records in between.
+class Player {
+
+    struct RecordHeader {
+        uint32_t type;
+        uint32_t size;
+        uint64_t step;
+    };
+
+    const uint8_t *     data;
+    size_t              size;
+    int                 descriptor;
+
+    std::vector< std::pair< uint64_t, uint64_t > > snapshots;     // (step, offset)
+    size_t              cursor;
+    uint64_t            endStep;
+
+    bool readHeader(size_t offset, RecordHeader & header) const;
+    bool readIndex();
+    void scanRecords();
+    void applyRecords(ParticleSystem & system, SceneState & scene);
+
+public:
+
+    Player();
+    ~Player();
+
+    bool open(const std::string & path);
+    void close();
+    bool isOpen() const { return data != NULL; };
+
+    bool seek(uint64_t step, ParticleSystem & system, SceneState & scene);
+
+    // Applies the input recorded before the system's next step and takes
+    // it; false once the recording is exhausted
+    bool step(ParticleSystem & system, SceneState & scene);
+
+    size_t snapshotCount() const { return snapshots.size(); };
+    uint64_t firstStep() const { return snapshots.empty() ? 0 : snapshots.front().first; };
+    uint64_t lastStep() const { return endStep; };
+};
@@ -0,0 +1,50 @@
+#include "RenderFrame.h"
+
+
+RenderFrame::RenderFrame()
+{
+    step = 0;
+    time = 0.0;
+    timeStep = 1.f / 60.f;
+    interpolation = 1.f;
+}
+
+void RenderFrame::capture(const ParticleSystem & system, double time)
+{
+    const ParticleStore & particles = system.particles;
+
+    step = system.stepCount;
+    this->time = time;
+    timeStep = system.timeStep;
+    interpolation = system.getInterpolation();
+    world = system.getWorld();
+
+    position.assign(particles.position.begin(), particles.position.end());
+    prevPosition.assign(particles.prevPosition.begin(), particles.prevPosition.end());
+    color.assign(particles.color.begin(), particles.color.end());
+    radius.assign(particles.radius.begin(), particles.radius.end());
+
+    springs.resize(system.springs.size());
+    for (size_t i = 0; i < springs.size(); i++){
+        const Spring & spring = system.springs[i];
+        springs[i].a = (uint32_t)particles.indexOf(spring.particleA);
+        springs[i].b = (uint32_t)particles.indexOf(spring.particleB);
+    }
+
+    system.trails.build(particles, particles.position, world, 1.f, trails);
+}
+
+// The system's own interpolation at capture, carried on by the time since;
+// a frame older than a step holds at the latest positions. Like the
+// system's, it takes the short way across the edges of a periodic world.
+void RenderFrame::interpolatePositions(double now, std::vector< ci::Vec2f > & positions) const
+{
+    float alpha = interpolation;
+    if (timeStep > 0.f)
+        alpha += (float)((now - time) / timeStep);
+    alpha = ci::math<float>::clamp(alpha, 0.f, 1.f);
+
+    positions.resize(position.size());
+    for (size_t i = 0; i < position.size(); i++)
+        positions[i] = prevPosition[i] + world.delta(prevPosition[i], position[i]) * alpha;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "cinder/Vector.h"
+#include "cinder/Color.h"
+
+#include "ParticleSystem.h"
+
+#include <vector>
+#include <cstdint>
+
+// Dense indices of the two particles a spring joins
+struct SpringLink {
+    uint32_t a, b;
+};
+
+// What drawing needs of a ParticleSystem after a step, copied out of it so
+// the renderer can work on another thread while the system moves on. The
+// arrays keep their capacity, so capturing into the same frame again only
+// allocates when the system has grown.
+class RenderFrame {
+
+public:
+
+    RenderFrame();
+
+    // `time` is when the capture happened, in seconds on the caller's clock
+    void capture(const ParticleSystem & system, double time);
+
+    // Positions `now` seconds on that clock, between the last two steps
+    void interpolatePositions(double now, std::vector< ci::Vec2f > & positions) const;
+
+    size_t size() const { return position.size(); };
+
+    uint64_t                    step;
+    double                      time;
+    float                       timeStep;
+    float                       interpolation;
+    WorldBounds                 world;
+
+    std::vector< ci::Vec2f >    position;
+    std::vector< ci::Vec2f >    prevPosition;
+    std::vector< ci::Color >    color;
+    std::vector< float >        radius;
+    std::vector< SpringLink >   springs;
+
+    // The system's trails at full alpha, leading from the latest positions
+    std::vector< LineVertex >   trails;
+};
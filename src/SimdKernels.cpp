@@ -0,0 +1,562 @@
+#include "SimdKernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define SIMD_HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 code is compiled per function so the rest of the build keeps its
+// baseline instruction set; it only runs where the CPU reports support.
+#if defined(SIMD_HAS_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_HAS_AVX2
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+
+void FlockSums::clear()
+{
+    separation = ci::Vec2f::zero();
+    velocity = ci::Vec2f::zero();
+    position = ci::Vec2f::zero();
+    separationCount = 0;
+    neighborCount = 0;
+}
+
+// Which sums a rule set reads; alignment and cohesion share the count
+#define SUMS_SEPARATION(RULES)  (((RULES) & FLOCK_SEPARATION) != 0)
+#define SUMS_NEIGHBORS(RULES)   (((RULES) & (FLOCK_ALIGNMENT | FLOCK_COHESION)) != 0)
+#define SUMS_VELOCITY(RULES)    (((RULES) & FLOCK_ALIGNMENT) != 0)
+#define SUMS_POSITION(RULES)    (((RULES) & FLOCK_COHESION) != 0)
+
+// Scalar kernels, also used for the tails the vector loops leave over
+
+template< unsigned RULES >
+static void accumulateScalar(const float * x, const float * y,
+                             const float * vx, const float * vy, size_t count,
+                             const ci::Vec2f & position,
+                             float separationSq, float neighboringSq,
+                             FlockSums & sums)
+{
+    for (size_t i = 0; i < count; i++){
+        float dx = position.x - x[i];
+        float dy = position.y - y[i];
+        float d2 = dx * dx + dy * dy;
+        if (d2 <= 0.f) continue;
+
+        if (SUMS_SEPARATION(RULES) && d2 < separationSq){
+            sums.separation += ci::Vec2f(dx / d2, dy / d2);
+            sums.separationCount++;
+        }
+        if (SUMS_NEIGHBORS(RULES) && d2 < neighboringSq){
+            if (SUMS_VELOCITY(RULES))
+                sums.velocity += ci::Vec2f(vx[i], vy[i]);
+            if (SUMS_POSITION(RULES))
+                sums.position += ci::Vec2f(x[i], y[i]);
+            sums.neighborCount++;
+        }
+    }
+}
+
+static ci::Vec2f steerScalar(const ci::Vec2f * directions, const float * weights, int count,
+                             const ci::Vec2f & velocity, float maxSpeed, float maxForce)
+{
+    ci::Vec2f acc = ci::Vec2f::zero();
+    for (int i = 0; i < count; i++){
+        ci::Vec2f steer = directions[i];
+        float d2 = steer.lengthSquared();
+        if (d2 > 0.f){
+            steer *= maxSpeed / std::sqrt(d2);
+            steer -= velocity;
+            steer.limit(maxForce);
+        }
+        acc += steer * weights[i];
+    }
+    return acc;
+}
+
+static void relaxScalar(SpringLanes & lanes)
+{
+    for (int i = 0; i < SPRING_LANES; i++){
+        float dx = lanes.ax[i] - lanes.bx[i];
+        float dy = lanes.ay[i] - lanes.by[i];
+        float length2 = dx * dx + dy * dy;
+        if (length2 <= 0.f) continue;
+
+        float k = (1.f - lanes.rest[i] / std::sqrt(length2)) * lanes.strength[i] /
+                  (lanes.invMassA[i] + lanes.invMassB[i]);
+        lanes.ax[i] -= dx * k * lanes.invMassA[i];
+        lanes.ay[i] -= dy * k * lanes.invMassA[i];
+        lanes.bx[i] += dx * k * lanes.invMassB[i];
+        lanes.by[i] += dy * k * lanes.invMassB[i];
+    }
+}
+
+#ifdef SIMD_HAS_SSE2
+
+static inline float horizontalSum(__m128 v)
+{
+    float lanes[4];
+    _mm_storeu_ps(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+static inline __m128 blend(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Estimate plus one Newton-Raphson step, good to about 22 bits
+static inline __m128 reciprocalSqrt(__m128 x)
+{
+    __m128 r = _mm_rsqrt_ps(x);
+    __m128 xrr = _mm_mul_ps(_mm_mul_ps(x, r), r);
+    return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(.5f), r), _mm_sub_ps(_mm_set1_ps(3.f), xrr));
+}
+
+template< unsigned RULES >
+static void accumulateSse2(const float * x, const float * y,
+                           const float * vx, const float * vy, size_t count,
+                           const ci::Vec2f & position,
+                           float separationSq, float neighboringSq,
+                           FlockSums & sums)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 px = _mm_set1_ps(position.x);
+    const __m128 py = _mm_set1_ps(position.y);
+    const __m128 sepSq = _mm_set1_ps(separationSq);
+    const __m128 nbSq = _mm_set1_ps(neighboringSq);
+
+    __m128 sepX = zero, sepY = zero, sepN = zero;
+    __m128 velX = zero, velY = zero, posX = zero, posY = zero, nbN = zero;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4){
+        __m128 cx = _mm_loadu_ps(x + i);
+        __m128 cy = _mm_loadu_ps(y + i);
+        __m128 dx = _mm_sub_ps(px, cx);
+        __m128 dy = _mm_sub_ps(py, cy);
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+        __m128 valid = _mm_cmpgt_ps(d2, zero);
+
+        if (SUMS_SEPARATION(RULES)){
+            // Lanes at zero distance divide by zero, but are masked out
+            __m128 sepMask = _mm_and_ps(valid, _mm_cmplt_ps(d2, sepSq));
+            __m128 inv = _mm_div_ps(one, d2);
+            sepX = _mm_add_ps(sepX, _mm_and_ps(sepMask, _mm_mul_ps(dx, inv)));
+            sepY = _mm_add_ps(sepY, _mm_and_ps(sepMask, _mm_mul_ps(dy, inv)));
+            sepN = _mm_add_ps(sepN, _mm_and_ps(sepMask, one));
+        }
+        if (SUMS_NEIGHBORS(RULES)){
+            __m128 nbMask = _mm_and_ps(valid, _mm_cmplt_ps(d2, nbSq));
+            if (SUMS_VELOCITY(RULES)){
+                velX = _mm_add_ps(velX, _mm_and_ps(nbMask, _mm_loadu_ps(vx + i)));
+                velY = _mm_add_ps(velY, _mm_and_ps(nbMask, _mm_loadu_ps(vy + i)));
+            }
+            if (SUMS_POSITION(RULES)){
+                posX = _mm_add_ps(posX, _mm_and_ps(nbMask, cx));
+                posY = _mm_add_ps(posY, _mm_and_ps(nbMask, cy));
+            }
+            nbN = _mm_add_ps(nbN, _mm_and_ps(nbMask, one));
+        }
+    }
+
+    if (SUMS_SEPARATION(RULES)){
+        sums.separation += ci::Vec2f(horizontalSum(sepX), horizontalSum(sepY));
+        sums.separationCount += (int)horizontalSum(sepN);
+    }
+    if (SUMS_VELOCITY(RULES))
+        sums.velocity += ci::Vec2f(horizontalSum(velX), horizontalSum(velY));
+    if (SUMS_POSITION(RULES))
+        sums.position += ci::Vec2f(horizontalSum(posX), horizontalSum(posY));
+    if (SUMS_NEIGHBORS(RULES))
+        sums.neighborCount += (int)horizontalSum(nbN);
+
+    accumulateScalar< RULES >(x + i, y + i, vx + i, vy + i, count - i,
+                              position, separationSq, neighboringSq, sums);
+}
+
+static ci::Vec2f steerSse2(const ci::Vec2f * directions, const float * weights, int count,
+                           const ci::Vec2f & velocity, float maxSpeed, float maxForce)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 velX = _mm_set1_ps(velocity.x);
+    const __m128 velY = _mm_set1_ps(velocity.y);
+    const __m128 speed = _mm_set1_ps(maxSpeed);
+    const __m128 force = _mm_set1_ps(maxForce);
+    const __m128 forceSq = _mm_set1_ps(maxForce * maxForce);
+
+    ci::Vec2f acc = ci::Vec2f::zero();
+    for (int first = 0; first < count; first += 4){
+        float dirX[4] = { 0.f }, dirY[4] = { 0.f }, weight[4] = { 0.f };
+        for (int i = 0; i < 4 && first + i < count; i++){
+            dirX[i] = directions[first + i].x;
+            dirY[i] = directions[first + i].y;
+            weight[i] = weights[first + i];
+        }
+        __m128 x = _mm_loadu_ps(dirX);
+        __m128 y = _mm_loadu_ps(dirY);
+
+        // Normalize to maxSpeed, zero directions stay zero
+        __m128 length2 = _mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y));
+        __m128 nonZero = _mm_cmpgt_ps(length2, zero);
+        __m128 scale = _mm_mul_ps(speed, reciprocalSqrt(length2));
+        __m128 sx = blend(nonZero, _mm_sub_ps(_mm_mul_ps(x, scale), velX), x);
+        __m128 sy = blend(nonZero, _mm_sub_ps(_mm_mul_ps(y, scale), velY), y);
+
+        // Limit to maxForce
+        __m128 steer2 = _mm_add_ps(_mm_mul_ps(sx, sx), _mm_mul_ps(sy, sy));
+        __m128 over = _mm_cmpgt_ps(steer2, forceSq);
+        __m128 ratio = _mm_mul_ps(force, reciprocalSqrt(steer2));
+        sx = blend(over, _mm_mul_ps(sx, ratio), sx);
+        sy = blend(over, _mm_mul_ps(sy, ratio), sy);
+
+        __m128 w = _mm_loadu_ps(weight);
+        acc += ci::Vec2f(horizontalSum(_mm_mul_ps(sx, w)), horizontalSum(_mm_mul_ps(sy, w)));
+    }
+    return acc;
+}
+
+static void relaxSse2(SpringLanes & lanes)
+{
+    __m128 ax = _mm_loadu_ps(lanes.ax);
+    __m128 ay = _mm_loadu_ps(lanes.ay);
+    __m128 bx = _mm_loadu_ps(lanes.bx);
+    __m128 by = _mm_loadu_ps(lanes.by);
+    __m128 invA = _mm_loadu_ps(lanes.invMassA);
+    __m128 invB = _mm_loadu_ps(lanes.invMassB);
+
+    __m128 dx = _mm_sub_ps(ax, bx);
+    __m128 dy = _mm_sub_ps(ay, by);
+    __m128 length2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+    __m128 stretch = _mm_sub_ps(_mm_set1_ps(1.f),
+                                _mm_mul_ps(_mm_loadu_ps(lanes.rest), reciprocalSqrt(length2)));
+    __m128 k = _mm_mul_ps(stretch, _mm_div_ps(_mm_loadu_ps(lanes.strength), _mm_add_ps(invA, invB)));
+    k = _mm_and_ps(_mm_cmpgt_ps(length2, _mm_setzero_ps()), k);
+
+    __m128 kA = _mm_mul_ps(k, invA);
+    __m128 kB = _mm_mul_ps(k, invB);
+    _mm_storeu_ps(lanes.ax, _mm_sub_ps(ax, _mm_mul_ps(dx, kA)));
+    _mm_storeu_ps(lanes.ay, _mm_sub_ps(ay, _mm_mul_ps(dy, kA)));
+    _mm_storeu_ps(lanes.bx, _mm_add_ps(bx, _mm_mul_ps(dx, kB)));
+    _mm_storeu_ps(lanes.by, _mm_add_ps(by, _mm_mul_ps(dy, kB)));
+}
+
+#endif
+
+#ifdef SIMD_HAS_AVX2
+
+SIMD_TARGET_AVX2
+static inline float horizontalSum(__m256 v)
+{
+    float lanes[8];
+    _mm256_storeu_ps(lanes, v);
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+           ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+template< unsigned RULES >
+SIMD_TARGET_AVX2
+static void accumulateAvx2(const float * x, const float * y,
+                           const float * vx, const float * vy, size_t count,
+                           const ci::Vec2f & position,
+                           float separationSq, float neighboringSq,
+                           FlockSums & sums)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 px = _mm256_set1_ps(position.x);
+    const __m256 py = _mm256_set1_ps(position.y);
+    const __m256 sepSq = _mm256_set1_ps(separationSq);
+    const __m256 nbSq = _mm256_set1_ps(neighboringSq);
+
+    __m256 sepX = zero, sepY = zero, sepN = zero;
+    __m256 velX = zero, velY = zero, posX = zero, posY = zero, nbN = zero;
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8){
+        __m256 cx = _mm256_loadu_ps(x + i);
+        __m256 cy = _mm256_loadu_ps(y + i);
+        __m256 dx = _mm256_sub_ps(px, cx);
+        __m256 dy = _mm256_sub_ps(py, cy);
+        __m256 d2 = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+
+        __m256 valid = _mm256_cmp_ps(d2, zero, _CMP_GT_OQ);
+
+        if (SUMS_SEPARATION(RULES)){
+            __m256 sepMask = _mm256_and_ps(valid, _mm256_cmp_ps(d2, sepSq, _CMP_LT_OQ));
+            __m256 inv = _mm256_div_ps(one, d2);
+            sepX = _mm256_add_ps(sepX, _mm256_and_ps(sepMask, _mm256_mul_ps(dx, inv)));
+            sepY = _mm256_add_ps(sepY, _mm256_and_ps(sepMask, _mm256_mul_ps(dy, inv)));
+            sepN = _mm256_add_ps(sepN, _mm256_and_ps(sepMask, one));
+        }
+        if (SUMS_NEIGHBORS(RULES)){
+            __m256 nbMask = _mm256_and_ps(valid, _mm256_cmp_ps(d2, nbSq, _CMP_LT_OQ));
+            if (SUMS_VELOCITY(RULES)){
+                velX = _mm256_add_ps(velX, _mm256_and_ps(nbMask, _mm256_loadu_ps(vx + i)));
+                velY = _mm256_add_ps(velY, _mm256_and_ps(nbMask, _mm256_loadu_ps(vy + i)));
+            }
+            if (SUMS_POSITION(RULES)){
+                posX = _mm256_add_ps(posX, _mm256_and_ps(nbMask, cx));
+                posY = _mm256_add_ps(posY, _mm256_and_ps(nbMask, cy));
+            }
+            nbN = _mm256_add_ps(nbN, _mm256_and_ps(nbMask, one));
+        }
+    }
+
+    if (SUMS_SEPARATION(RULES)){
+        sums.separation += ci::Vec2f(horizontalSum(sepX), horizontalSum(sepY));
+        sums.separationCount += (int)horizontalSum(sepN);
+    }
+    if (SUMS_VELOCITY(RULES))
+        sums.velocity += ci::Vec2f(horizontalSum(velX), horizontalSum(velY));
+    if (SUMS_POSITION(RULES))
+        sums.position += ci::Vec2f(horizontalSum(posX), horizontalSum(posY));
+    if (SUMS_NEIGHBORS(RULES))
+        sums.neighborCount += (int)horizontalSum(nbN);
+
+    accumulateSse2< RULES >(x + i, y + i, vx + i, vy + i, count - i,
+                            position, separationSq, neighboringSq, sums);
+}
+
+#endif
+
+// Dispatch
+
+SimdLevel detectSimdLevel()
+{
+#ifdef SIMD_HAS_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+#endif
+#ifdef SIMD_HAS_SSE2
+    return SIMD_SSE2;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+static SimdLevel initialSimdLevel()
+{
+    SimdLevel level = detectSimdLevel();
+#ifndef NDEBUG
+    while (level > SIMD_SCALAR && ! verifySimdKernels(level)){
+        SimdLevel fallback = (SimdLevel)(level - 1);
+        fprintf(stderr, "SIMD kernels: %s results differ from scalar ones, falling back to %s\n",
+                simdLevelName(level), simdLevelName(fallback));
+        level = fallback;
+    }
+#endif
+    return level;
+}
+
+static std::atomic< int > & selectedSimdLevel()
+{
+    static std::atomic< int > level(initialSimdLevel());
+    return level;
+}
+
+SimdLevel activeSimdLevel()
+{
+    return (SimdLevel)selectedSimdLevel().load(std::memory_order_relaxed);
+}
+
+// Levels above what the CPU supports fall back to the best supported one
+void setSimdLevel(SimdLevel level)
+{
+    SimdLevel supported = detectSimdLevel();
+    selectedSimdLevel().store(level > supported ? supported : level);
+}
+
+const char * simdLevelName(SimdLevel level)
+{
+    switch (level){
+        case SIMD_AVX2: return "AVX2";
+        case SIMD_SSE2: return "SSE2";
+        default:        return "Scalar";
+    }
+}
+
+template< unsigned RULES >
+void accumulateFlocking(const float * x, const float * y,
+                        const float * vx, const float * vy, size_t count,
+                        const ci::Vec2f & position,
+                        float separationSq, float neighboringSq,
+                        FlockSums & sums, SimdLevel level)
+{
+    if (RULES == 0)
+        return;
+#ifdef SIMD_HAS_AVX2
+    if (level >= SIMD_AVX2){
+        accumulateAvx2< RULES >(x, y, vx, vy, count, position, separationSq, neighboringSq, sums);
+        return;
+    }
+#endif
+#ifdef SIMD_HAS_SSE2
+    if (level >= SIMD_SSE2){
+        accumulateSse2< RULES >(x, y, vx, vy, count, position, separationSq, neighboringSq, sums);
+        return;
+    }
+#endif
+    accumulateScalar< RULES >(x, y, vx, vy, count, position, separationSq, neighboringSq, sums);
+}
+
+#define INSTANTIATE_ACCUMULATE(RULES) \
+    template void accumulateFlocking< RULES >(const float *, const float *, const float *, const float *, \
+                                              size_t, const ci::Vec2f &, float, float, FlockSums &, SimdLevel);
+
+INSTANTIATE_ACCUMULATE(0)
+INSTANTIATE_ACCUMULATE(1)
+INSTANTIATE_ACCUMULATE(2)
+INSTANTIATE_ACCUMULATE(3)
+INSTANTIATE_ACCUMULATE(4)
+INSTANTIATE_ACCUMULATE(5)
+INSTANTIATE_ACCUMULATE(6)
+INSTANTIATE_ACCUMULATE(7)
+
+// Only a handful of directions per particle, so AVX2 shares the SSE2 path
+ci::Vec2f steerAlongSum(const ci::Vec2f * directions, const float * weights, int count,
+                        const ci::Vec2f & velocity, float maxSpeed, float maxForce,
+                        SimdLevel level)
+{
+#ifdef SIMD_HAS_SSE2
+    if (level >= SIMD_SSE2)
+        return steerSse2(directions, weights, count, velocity, maxSpeed, maxForce);
+#endif
+    return steerScalar(directions, weights, count, velocity, maxSpeed, maxForce);
+}
+
+void relaxSprings(SpringLanes & lanes, SimdLevel level)
+{
+#ifdef SIMD_HAS_SSE2
+    if (level >= SIMD_SSE2){
+        relaxSse2(lanes);
+        return;
+    }
+#endif
+    relaxScalar(lanes);
+}
+
+// Verification
+
+static float nextRandom(uint32_t & seed)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return (float)(seed >> 8) / 16777216.f;
+}
+
+static bool nearlyEqual(float a, float b, float tolerance)
+{
+    float scale = std::max(1.f, std::max(std::fabs(a), std::fabs(b)));
+    return std::fabs(a - b) <= tolerance * scale;
+}
+
+static bool nearlyEqual(const ci::Vec2f & a, const ci::Vec2f & b, float tolerance)
+{
+    return nearlyEqual(a.x, b.x, tolerance) && nearlyEqual(a.y, b.y, tolerance);
+}
+
+// One rule set's sums at `level` against the scalar kernel's
+template< unsigned RULES >
+static bool sameSums(const float * x, const float * y,
+                     const float * vx, const float * vy, size_t count,
+                     const ci::Vec2f & position, float separationSq, float neighboringSq,
+                     SimdLevel level, float tolerance)
+{
+    FlockSums expected, actual;
+    accumulateFlocking< RULES >(x, y, vx, vy, count, position, separationSq, neighboringSq, expected, SIMD_SCALAR);
+    accumulateFlocking< RULES >(x, y, vx, vy, count, position, separationSq, neighboringSq, actual, level);
+
+    return expected.separationCount == actual.separationCount &&
+           expected.neighborCount == actual.neighborCount &&
+           nearlyEqual(expected.separation, actual.separation, tolerance) &&
+           nearlyEqual(expected.velocity, actual.velocity, tolerance) &&
+           nearlyEqual(expected.position, actual.position, tolerance);
+}
+
+typedef bool (* AccumulateCheck)(const float *, const float *, const float *, const float *, size_t,
+                                 const ci::Vec2f &, float, float, SimdLevel, float);
+
+bool verifySimdKernels(SimdLevel level, float tolerance)
+{
+    uint32_t seed = 12345;
+
+    // Candidates around the particle, one of them at its own position, and
+    // none close enough to a threshold for rounding to change the counts
+    const size_t count = 203;
+    const ci::Vec2f position(100.f, 100.f);
+    const float separationSq = 30.f * 30.f;
+    const float neighboringSq = 60.f * 60.f;
+
+    float x[count], y[count], vx[count], vy[count];
+    for (size_t i = 0; i < count; i++){
+        do {
+            x[i] = nextRandom(seed) * 200.f;
+            y[i] = nextRandom(seed) * 200.f;
+        } while (std::fabs(position.distanceSquared(ci::Vec2f(x[i], y[i])) - separationSq) < 1.f ||
+                 std::fabs(position.distanceSquared(ci::Vec2f(x[i], y[i])) - neighboringSq) < 1.f);
+        vx[i] = nextRandom(seed) * 2.f - 1.f;
+        vy[i] = nextRandom(seed) * 2.f - 1.f;
+    }
+    x[count / 2] = position.x;
+    y[count / 2] = position.y;
+
+    static const AccumulateCheck accumulateChecks[FLOCK_RULE_SETS] = {
+        & sameSums< 0 >, & sameSums< 1 >, & sameSums< 2 >, & sameSums< 3 >,
+        & sameSums< 4 >, & sameSums< 5 >, & sameSums< 6 >, & sameSums< 7 >
+    };
+    for (auto check : accumulateChecks)
+        if (! check(x, y, vx, vy, count, position, separationSq, neighboringSq, level, tolerance))
+            return false;
+
+    for (int trial = 0; trial < 16; trial++){
+        ci::Vec2f directions[5];
+        float weights[5];
+        for (int i = 0; i < 5; i++){
+            directions[i] = ci::Vec2f(nextRandom(seed) - .5f, nextRandom(seed) - .5f) * 50.f;
+            weights[i] = nextRandom(seed) * 2.f;
+        }
+        directions[trial % 5] = ci::Vec2f::zero();
+        ci::Vec2f velocity(nextRandom(seed) - .5f, nextRandom(seed) - .5f);
+
+        if (! nearlyEqual(steerAlongSum(directions, weights, 5, velocity, 1.f, .05f, SIMD_SCALAR),
+                          steerAlongSum(directions, weights, 5, velocity, 1.f, .05f, level),
+                          tolerance))
+            return false;
+    }
+
+    for (int trial = 0; trial < 16; trial++){
+        SpringLanes lanes;
+        for (int i = 0; i < SPRING_LANES; i++){
+            lanes.ax[i] = nextRandom(seed) * 200.f;
+            lanes.ay[i] = nextRandom(seed) * 200.f;
+            lanes.bx[i] = nextRandom(seed) * 200.f;
+            lanes.by[i] = nextRandom(seed) * 200.f;
+            lanes.invMassA[i] = 1.f / (1.f + nextRandom(seed) * 4.f);
+            lanes.invMassB[i] = 1.f / (1.f + nextRandom(seed) * 4.f);
+            lanes.rest[i] = nextRandom(seed) * 100.f;
+            lanes.strength[i] = nextRandom(seed) * .005f;
+        }
+        SpringLanes reference = lanes;
+        relaxSprings(reference, SIMD_SCALAR);
+        relaxSprings(lanes, level);
+
+        for (int i = 0; i < SPRING_LANES; i++){
+            if (! nearlyEqual(reference.ax[i], lanes.ax[i], tolerance) ||
+                ! nearlyEqual(reference.ay[i], lanes.ay[i], tolerance) ||
+                ! nearlyEqual(reference.bx[i], lanes.bx[i], tolerance) ||
+                ! nearlyEqual(reference.by[i], lanes.by[i], tolerance))
+                return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "cinder/Vector.h"
+
+#include <cstddef>
+
+// Vectorized inner loops for flocking and springs. Each kernel has a scalar
+// version and SSE2/AVX2 versions on x86; the widest one the CPU supports is
+// picked once at startup (and checked against the scalar one in debug
+// builds, falling back a level with a note on stderr if they differ) unless
+// overridden with setSimdLevel(). `Benchmark --verify` checks every level
+// the CPU supports in any build.
+
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE2,      // 4 lanes
+    SIMD_AVX2       // 8 lanes
+};
+
+SimdLevel detectSimdLevel();
+SimdLevel activeSimdLevel();
+void setSimdLevel(SimdLevel level);
+const char * simdLevelName(SimdLevel level);
+
+// Flocking rules as bits of a rule set; code templated on a rule set is
+// instantiated for all FLOCK_RULE_SETS of them and leaves out what the
+// disabled rules would compute
+enum FlockingRule {
+    FLOCK_SEPARATION    = 1,
+    FLOCK_ALIGNMENT     = 2,
+    FLOCK_COHESION      = 4,
+    FLOCK_ALL_RULES     = 7,
+    FLOCK_RULE_SETS     = 8
+};
+
+// Running sums of the three flocking rules over a particle's neighbors
+struct FlockSums {
+
+    FlockSums() { clear(); };
+    void clear();
+
+    ci::Vec2f   separation;     // sum of diff / |diff|^2 within targetSeparation
+    ci::Vec2f   velocity;       // neighbors' velocities within neighboringDistance
+    ci::Vec2f   position;       // neighbors' positions within neighboringDistance
+    int         separationCount;
+    int         neighborCount;
+};
+
+// Adds `count` candidates, given as contiguous coordinate arrays, to the sums
+// of a particle at `position`. Candidates at zero distance are skipped, and
+// only the sums the rules in RULES read are touched.
+template< unsigned RULES >
+void accumulateFlocking(const float * x, const float * y,
+                        const float * vx, const float * vy, size_t count,
+                        const ci::Vec2f & position,
+                        float separationSq, float neighboringSq,
+                        FlockSums & sums, SimdLevel level = activeSimdLevel());
+
+// Weighted sum of up to four steering forces, each steering `velocity`
+// along one of `directions` at maxSpeed and limited to maxForce.
+ci::Vec2f steerAlongSum(const ci::Vec2f * directions, const float * weights, int count,
+                        const ci::Vec2f & velocity, float maxSpeed, float maxForce,
+                        SimdLevel level = activeSimdLevel());
+
+#define SPRING_LANES    4
+
+// Four springs with distinct endpoints, relaxed in place at once
+struct SpringLanes {
+
+    float   ax[SPRING_LANES], ay[SPRING_LANES];
+    float   bx[SPRING_LANES], by[SPRING_LANES];
+    float   invMassA[SPRING_LANES], invMassB[SPRING_LANES];
+    float   rest[SPRING_LANES], strength[SPRING_LANES];
+};
+
+void relaxSprings(SpringLanes & lanes, SimdLevel level = activeSimdLevel());
+
+// Runs every kernel at `level` and at SIMD_SCALAR on the same generated
+// input; false if any result differs by more than `tolerance` (relative).
+bool verifySimdKernels(SimdLevel level, float tolerance = 1e-3f);
@@ -0,0 +1,145 @@
+#include "SimulationThread.h"
+
+#include <algorithm>
+#include <chrono>
+
+
+#define COMMAND_QUEUE_CAPACITY  4096
+
+SimulationSettings::SimulationSettings(const ParticleSystem & system)
+{
+    springsPerParticle = system.springsPerParticle;
+    springRadius = system.springRadius;
+    springIterations = system.springIterations;
+    substeps = system.substeps;
+    maxStepsPerUpdate = system.maxStepsPerUpdate;
+    parallelStep = system.parallelStep;
+    trailLength = (int)system.trails.getLength();
+}
+
+bool SimulationSettings::operator==(const SimulationSettings & other) const
+{
+    return springsPerParticle == other.springsPerParticle &&
+           springRadius == other.springRadius &&
+           springIterations == other.springIterations &&
+           substeps == other.substeps &&
+           maxStepsPerUpdate == other.maxStepsPerUpdate &&
+           parallelStep == other.parallelStep &&
+           trailLength == other.trailLength;
+}
+
+void SimulationSettings::apply(ParticleSystem & system) const
+{
+    system.springsPerParticle = springsPerParticle;
+    system.springRadius = springRadius;
+    system.springIterations = springIterations;
+    system.substeps = substeps;
+    system.maxStepsPerUpdate = maxStepsPerUpdate;
+    system.parallelStep = parallelStep;
+    system.trails.setLength((size_t)std::max(trailLength, 0));
+}
+
+SimulationThread::SimulationThread() :
+    commands(COMMAND_QUEUE_CAPACITY), running(false), dropped(0)
+{
+    system = NULL;
+}
+
+SimulationThread::~SimulationThread()
+{
+    stop();
+}
+
+double SimulationThread::now()
+{
+    return std::chrono::duration< double >(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void SimulationThread::start(ParticleSystem & system)
+{
+    stop();
+
+    this->system = & system;
+    frames.writeBuffer().capture(system, now());
+    frames.publish();
+
+    running = true;
+    thread = std::thread(& SimulationThread::run, this);
+}
+
+void SimulationThread::stop()
+{
+    if (! system)
+        return;
+
+    running = false;
+    thread.join();
+
+    SimulationCommand command;
+    while (commands.pop(command))
+        apply(command);
+    system = NULL;
+}
+
+bool SimulationThread::push(const SimulationCommand & command)
+{
+    if (commands.push(command))
+        return true;
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+const RenderFrame & SimulationThread::latestFrame()
+{
+    frames.update();
+    return frames.readBuffer();
+}
+
+void SimulationThread::apply(const SimulationCommand & command)
+{
+    switch (command.type){
+        case SIMULATION_SPAWN: {
+            const ParticleSpawn & spawn = command.spawn;
+            system->addParticle(spawn.position, spawn.radius, spawn.mass, spawn.drag,
+                                spawn.targetSeparation, spawn.neighboringDistance, spawn.color);
+            break;
+        }
+        case SIMULATION_CLEAR:
+            system->clear();
+            break;
+        case SIMULATION_RECOLOR:
+            system->recolor(command.color, command.newColor);
+            break;
+        case SIMULATION_CONTROLS: {
+            SceneState scene;
+            command.controls.apply(* system, scene);
+            break;
+        }
+        case SIMULATION_SETTINGS:
+            command.settings.apply(* system);
+            break;
+    }
+}
+
+// Sleeps until the next step is due, so the system's accumulator sees
+// about one step's worth of time per pass
+void SimulationThread::run()
+{
+    double last = now();
+    while (running.load(std::memory_order_acquire)){
+        SimulationCommand command;
+        while (commands.pop(command))
+            apply(command);
+
+        double current = now();
+        system->update(current - last);
+        last = current;
+
+        frames.writeBuffer().capture(* system, current);
+        frames.publish();
+
+        double wait = (1.f - system->getInterpolation()) * system->timeStep;
+        std::this_thread::sleep_for(std::chrono::duration< double >(wait));
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "cinder/Vector.h"
+#include "cinder/Color.h"
+
+#include "ParticleSystem.h"
+#include "Recording.h"
+#include "RenderFrame.h"
+#include "MpscQueue.h"
+#include "TripleBuffer.h"
+
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+// The system's tuning as the app's settings panel edits it, so the panel
+// can write a copy instead of a system another thread is stepping
+struct SimulationSettings {
+
+    SimulationSettings() :
+        springsPerParticle(0), springRadius(0.f), springIterations(1),
+        substeps(1), maxStepsPerUpdate(1), parallelStep(false), trailLength(0) {};
+    explicit SimulationSettings(const ParticleSystem & system);
+
+    bool operator==(const SimulationSettings & other) const;
+    bool operator!=(const SimulationSettings & other) const { return !(* this == other); };
+
+    void apply(ParticleSystem & system) const;
+
+    int         springsPerParticle;
+    float       springRadius;
+    int         springIterations;
+    int         substeps;
+    int         maxStepsPerUpdate;
+    bool        parallelStep;
+    int         trailLength;
+};
+
+enum SimulationCommandType {
+    SIMULATION_SPAWN,       // spawn
+    SIMULATION_CLEAR,
+    SIMULATION_RECOLOR,     // color to newColor
+    SIMULATION_CONTROLS,    // controls, which also move the attractor
+    SIMULATION_SETTINGS     // settings
+};
+
+struct SimulationCommand {
+
+    SimulationCommand() : type(SIMULATION_CLEAR) {};
+    SimulationCommand(SimulationCommandType type) : type(type) {};
+
+    SimulationCommandType   type;
+    ParticleSpawn           spawn;
+    ci::Color               color, newColor;
+    RecordedControls        controls;
+    SimulationSettings      settings;
+};
+
+// Steps a ParticleSystem on a thread of its own, at the system's fixed
+// timestep, so drawing and stepping stop holding each other up.
+//
+// While it runs the thread owns the system. Input reaches it as commands
+// through a lock-free queue that any thread may push to, applied before
+// each step. After each step it captures a RenderFrame into a triple
+// buffer, and the render thread picks up the latest one without waiting.
+class SimulationThread {
+
+    ParticleSystem *                    system;
+    MpscQueue< SimulationCommand >      commands;
+    TripleBuffer< RenderFrame >         frames;
+
+    std::thread                         thread;
+    std::atomic< bool >                 running;
+    std::atomic< uint64_t >             dropped;
+
+    void run();
+    void apply(const SimulationCommand & command);
+
+public:
+
+    SimulationThread();
+    ~SimulationThread();
+
+    void start(ParticleSystem & system);
+
+    // Applies the commands still queued, then hands the system back
+    void stop();
+    bool isRunning() const { return system != NULL; };
+
+    // Never blocks; false, and counted, when the queue is full
+    bool push(const SimulationCommand & command);
+    uint64_t commandsDropped() const { return dropped.load(std::memory_order_relaxed); };
+
+    // Render thread only; the latest frame stays valid until the next call
+    const RenderFrame & latestFrame();
+
+    // Seconds on the clock frames are captured against
+    static double now();
+};
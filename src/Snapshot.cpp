@@ -0,0 +1,370 @@
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+#define QUANTIZED_RANGE     65535.f
+
+// Bounding box of every position a quantized snapshot stores
+static void positionBounds(const ParticleStore & particles, ci::Vec2f & low, ci::Vec2f & high)
+{
+    low = high = particles.empty() ? ci::Vec2f::zero() : particles.position[0];
+    const std::vector< ci::Vec2f > * arrays[3] = {
+        &particles.position, &particles.prevPosition, &particles.anchor
+    };
+    for (auto array : arrays)
+        for (auto & position : * array){
+            low.x = std::min(low.x, position.x);
+            low.y = std::min(low.y, position.y);
+            high.x = std::max(high.x, position.x);
+            high.y = std::max(high.y, position.y);
+        }
+}
+
+static uint16_t quantize(float value, float low, float scale)
+{
+    float q = (value - low) * scale + .5f;
+    return (uint16_t)std::min(std::max(q, 0.f), QUANTIZED_RANGE);
+}
+
+static void putPositions(ByteWriter & out, const std::vector< ci::Vec2f > & positions,
+                         bool quantized, const ci::Vec2f & low, const ci::Vec2f & scale)
+{
+    for (auto & position : positions){
+        if (quantized){
+            out.put(quantize(position.x, low.x, scale.x));
+            out.put(quantize(position.y, low.y, scale.y));
+        } else {
+            out.put(position);
+        }
+    }
+}
+
+static bool getPosition(ByteReader & in, ci::Vec2f & position,
+                        bool quantized, const ci::Vec2f & low, const ci::Vec2f & step)
+{
+    if (! quantized)
+        return in.get(position);
+
+    uint16_t x, y;
+    if (! (in.get(x) && in.get(y)))
+        return false;
+    position = ci::Vec2f(low.x + x * step.x, low.y + y * step.y);
+    return true;
+}
+
+template< typename T >
+static void putArray(ByteWriter & out, const std::vector< T > & values)
+{
+    for (auto & value : values)
+        out.put(value);
+}
+
+template< typename T >
+static bool getArray(ByteReader & in, std::vector< T > & values)
+{
+    for (auto & value : values)
+        if (! in.get(value))
+            return false;
+    return true;
+}
+
+static void putRules(ByteWriter & out, const FlockingRules & rules)
+{
+    out.put((uint8_t)((rules.separationEnabled ? 1 : 0) |
+                      (rules.alignmentEnabled ? 2 : 0) |
+                      (rules.cohesionEnabled ? 4 : 0) |
+                      (rules.cohesionSteers ? 8 : 0)));
+    out.put(rules.separationFactor);
+    out.put(rules.alignmentFactor);
+    out.put(rules.cohesionFactor);
+}
+
+static bool getRules(ByteReader & in, FlockingRules & rules)
+{
+    uint8_t enabled = 0;
+    in.get(enabled);
+    in.get(rules.separationFactor);
+    in.get(rules.alignmentFactor);
+    in.get(rules.cohesionFactor);
+    rules.separationEnabled = (enabled & 1) != 0;
+    rules.alignmentEnabled = (enabled & 2) != 0;
+    rules.cohesionEnabled = (enabled & 4) != 0;
+    rules.cohesionSteers = (enabled & 8) != 0;
+    return in.ok();
+}
+
+// Version 1 kept the rules in every particle; each cluster takes those
+// of its first particle
+static bool getParticleRules(ByteReader & in, ParticleSystem & system)
+{
+    ParticleStore & particles = system.particles;
+    std::vector< FlockingRules > rules(particles.size());
+    for (auto & particleRules : rules) in.get(particleRules.separationFactor);
+    for (auto & particleRules : rules) in.get(particleRules.alignmentFactor);
+    for (auto & particleRules : rules) in.get(particleRules.cohesionFactor);
+    for (auto & particleRules : rules){
+        uint8_t enabled = 0;
+        in.get(enabled);
+        particleRules.separationEnabled = (enabled & 1) != 0;
+        particleRules.alignmentEnabled = (enabled & 2) != 0;
+        particleRules.cohesionEnabled = (enabled & 4) != 0;
+    }
+
+    for (size_t i = 0; i < particles.size(); i++){
+        size_t clusters = system.clusterCount();
+        particles.cluster[i] = system.clusterFor(particles.color[i]);
+        if (system.clusterCount() > clusters)
+            system.cluster(particles.cluster[i]).rules = rules[i];
+    }
+    return in.ok();
+}
+
+static bool getClusters(ByteReader & in, ParticleSystem & system)
+{
+    FlockingRules defaults;
+    uint32_t count = 0;
+    if (! (getRules(in, defaults) && in.get(count)))
+        return false;
+    system.setFlocking(defaults);
+
+    std::vector< ClusterId > ids;
+    for (uint32_t c = 0; c < count; c++){
+        ci::Color color;
+        in.get(color.r); in.get(color.g); in.get(color.b);
+        FlockingRules rules;
+        if (! getRules(in, rules))
+            return false;
+        ids.push_back(system.clusterFor(color));
+        system.cluster(ids.back()).rules = rules;
+    }
+
+    for (auto & cluster : system.particles.cluster){
+        ClusterId stored = 0;
+        if (! in.get(stored) || stored >= ids.size())
+            return false;
+        cluster = ids[stored];
+    }
+    return true;
+}
+
+// Particle arrays go one after another rather than one record per
+// particle, which keeps like values together for anyone compressing the
+// file afterwards
+void writeSnapshot(std::vector< uint8_t > & bytes, const ParticleSystem & system,
+                   const SceneState & scene, bool quantize)
+{
+    const ParticleStore & particles = system.particles;
+    const SpringStore & springs = system.springs;
+    ByteWriter out(bytes);
+
+    out.put((uint32_t)SNAPSHOT_MAGIC);
+    out.put((uint16_t)SNAPSHOT_VERSION);
+    out.put((uint16_t)((quantize ? SNAPSHOT_QUANTIZED : 0) |
+                       (system.isPeriodic() ? SNAPSHOT_PERIODIC : 0)));
+    out.put((uint64_t)system.stepCount);
+    out.put((uint32_t)system.getSeed());
+    out.put((uint32_t)particles.size());
+    out.put((uint32_t)springs.size());
+
+    const ci::Rectf & borders = system.getBorders();
+    out.put(borders.x1); out.put(borders.y1);
+    out.put(borders.x2); out.put(borders.y2);
+    out.put(system.attractor.center);
+    out.put(system.attractor.attraction);
+    out.put(system.attractor.repulsionRadius);
+    out.put(system.attractor.repulsion);
+    out.put((uint8_t)system.attractor.enabled);
+    out.put(system.timeStep);
+    out.put((int32_t)system.substeps);
+    out.put((int32_t)system.maxStepsPerUpdate);
+    out.put((int32_t)system.maxParticles);
+    out.put((int32_t)system.evictionMode);
+    out.put((int32_t)system.springsPerParticle);
+    out.put(system.springRadius);
+    out.put((int32_t)system.springIterations);
+    out.put((uint8_t)system.parallelStep);
+    out.put(scene.forceCenter);
+
+    ci::Vec2f low, high, scale;
+    if (quantize){
+        positionBounds(particles, low, high);
+        out.put(low);
+        out.put(high);
+        ci::Vec2f extent = high - low;
+        scale.x = extent.x > 0.f ? QUANTIZED_RANGE / extent.x : 0.f;
+        scale.y = extent.y > 0.f ? QUANTIZED_RANGE / extent.y : 0.f;
+    }
+
+    putPositions(out, particles.position, quantize, low, scale);
+    putPositions(out, particles.prevPosition, quantize, low, scale);
+    putPositions(out, particles.anchor, quantize, low, scale);
+    putArray(out, particles.velocity);
+    for (auto & color : particles.color){
+        if (quantize){
+            out.put((uint8_t)(ci::math<float>::clamp(color.r, 0.f, 1.f) * 255.f + .5f));
+            out.put((uint8_t)(ci::math<float>::clamp(color.g, 0.f, 1.f) * 255.f + .5f));
+            out.put((uint8_t)(ci::math<float>::clamp(color.b, 0.f, 1.f) * 255.f + .5f));
+        } else {
+            out.put(color.r); out.put(color.g); out.put(color.b);
+        }
+    }
+    putArray(out, particles.radius);
+    putArray(out, particles.mass);
+    putArray(out, particles.drag);
+    putArray(out, particles.maxSpeed);
+    putArray(out, particles.maxForce);
+    putArray(out, particles.targetSeparation);
+    putArray(out, particles.neighboringDistance);
+
+    putRules(out, system.getFlocking());
+    out.put((uint32_t)system.clusterCount());
+    for (size_t c = 0; c < system.clusterCount(); c++){
+        const ParticleCluster & cluster = system.cluster((ClusterId)c);
+        out.put(cluster.color.r); out.put(cluster.color.g); out.put(cluster.color.b);
+        putRules(out, cluster.rules);
+    }
+    putArray(out, particles.cluster);
+
+    std::vector< uint32_t > order;
+    particles.emissionOrder(order);
+    out.put((uint32_t)order.size());
+    putArray(out, order);
+
+    // Colors too, so the springs relax in the same order after a restore
+    for (size_t i = 0; i < springs.size(); i++){
+        const Spring & spring = springs[i];
+        out.put((uint32_t)particles.indexOf(spring.particleA));
+        out.put((uint32_t)particles.indexOf(spring.particleB));
+        out.put(spring.rest);
+        out.put(spring.strength);
+        out.put(springs.colorOf(i));
+    }
+}
+
+bool readSnapshot(const uint8_t * data, size_t size, ParticleSystem & system, SceneState & scene)
+{
+    ByteReader in(data, size);
+    system.clear();
+
+    uint32_t magic, seed, particleCount, springCount;
+    uint16_t version, flags;
+    uint64_t step;
+    if (! (in.get(magic) && in.get(version) && in.get(flags) && in.get(step) &&
+           in.get(seed) && in.get(particleCount) && in.get(springCount)))
+        return false;
+    if (magic != SNAPSHOT_MAGIC || version > SNAPSHOT_VERSION)
+        return false;
+
+    ci::Rectf borders;
+    uint8_t attractorEnabled, parallelStep;
+    int32_t substeps, maxStepsPerUpdate, maxParticles, evictionMode;
+    int32_t springsPerParticle, springIterations;
+    in.get(borders.x1); in.get(borders.y1);
+    in.get(borders.x2); in.get(borders.y2);
+    in.get(system.attractor.center);
+    in.get(system.attractor.attraction);
+    in.get(system.attractor.repulsionRadius);
+    in.get(system.attractor.repulsion);
+    in.get(attractorEnabled);
+    in.get(system.timeStep);
+    in.get(substeps);
+    in.get(maxStepsPerUpdate);
+    in.get(maxParticles);
+    in.get(evictionMode);
+    in.get(springsPerParticle);
+    in.get(system.springRadius);
+    in.get(springIterations);
+    in.get(parallelStep);
+    in.get(scene.forceCenter);
+    if (! in.ok())
+        return false;
+
+    system.setBorders(borders);
+    system.setPeriodic((flags & SNAPSHOT_PERIODIC) != 0);
+    system.attractor.enabled = attractorEnabled != 0;
+    system.substeps = substeps;
+    system.maxStepsPerUpdate = maxStepsPerUpdate;
+    system.maxParticles = maxParticles;
+    system.evictionMode = (EvictionMode)evictionMode;
+    system.springsPerParticle = springsPerParticle;
+    system.springIterations = springIterations;
+    system.parallelStep = parallelStep != 0;
+
+    bool quantized = (flags & SNAPSHOT_QUANTIZED) != 0;
+    ci::Vec2f low, high, quantum;
+    if (quantized){
+        if (! (in.get(low) && in.get(high)))
+            return false;
+        quantum = (high - low) / QUANTIZED_RANGE;
+    }
+
+    if (particleCount > system.particles.capacity() || springCount > system.springs.capacity())
+        system.setCapacity(std::max((size_t)particleCount, system.particles.capacity()),
+                           std::max((size_t)springCount, system.springs.capacity()));
+
+    // Add every particle first, then overwrite the arrays wholesale
+    ParticleStore & particles = system.particles;
+    for (uint32_t i = 0; i < particleCount; i++)
+        particles.add(ci::Vec2f::zero(), 0.f, 1.f, 0.f, 0.f, 0.f, ci::Color::black());
+
+    for (auto & position : particles.position)
+        if (! getPosition(in, position, quantized, low, quantum)) break;
+    for (auto & position : particles.prevPosition)
+        if (! getPosition(in, position, quantized, low, quantum)) break;
+    for (auto & position : particles.anchor)
+        if (! getPosition(in, position, quantized, low, quantum)) break;
+    getArray(in, particles.velocity);
+    for (auto & color : particles.color){
+        if (quantized){
+            uint8_t r = 0, g = 0, b = 0;
+            in.get(r); in.get(g); in.get(b);
+            color = ci::Color(r / 255.f, g / 255.f, b / 255.f);
+        } else {
+            in.get(color.r); in.get(color.g); in.get(color.b);
+        }
+    }
+    getArray(in, particles.radius);
+    getArray(in, particles.mass);
+    getArray(in, particles.drag);
+    getArray(in, particles.maxSpeed);
+    getArray(in, particles.maxForce);
+    getArray(in, particles.targetSeparation);
+    getArray(in, particles.neighboringDistance);
+    if (! (version < 2 ? getParticleRules(in, system) : getClusters(in, system))){
+        system.clear();
+        return false;
+    }
+
+    uint32_t orderCount = 0;
+    in.get(orderCount);
+    if (! in.ok() || orderCount > particleCount){
+        system.clear();
+        return false;
+    }
+    std::vector< uint32_t > order(orderCount);
+    getArray(in, order);
+    particles.setEmissionOrder(order);
+
+    for (uint32_t i = 0; i < springCount && in.ok(); i++){
+        uint32_t a, b;
+        float rest, strength;
+        uint8_t color;
+        if (! (in.get(a) && in.get(b) && in.get(rest) && in.get(strength) && in.get(color)))
+            break;
+        if (a >= particleCount || b >= particleCount){
+            system.clear();
+            return false;
+        }
+        system.addSpring(Spring(particles.handleAt(a), particles.handleAt(b), rest, strength), color);
+    }
+
+    if (! in.ok()){
+        system.clear();
+        return false;
+    }
+    system.stepCount = step;
+    system.reseed(seed);
+    return true;
+}
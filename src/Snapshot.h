@@ -0,0 +1,87 @@
+#pragma once
+
+#include "cinder/Vector.h"
+
+#include "ParticleSystem.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// Binary image of a ParticleSystem between two steps: every particle and
+// spring in dense order, the emission order, the system's settings and
+// the app's force centers. Restoring one and stepping on reproduces the
+// original run exactly, unless positions were quantized.
+//
+// Little-endian throughout, as on every platform the app ships on. Readers
+// reject other magic numbers and newer versions. Version 2 stores the
+// flocking rules per cluster instead of per particle.
+
+#define SNAPSHOT_MAGIC      0x504e5343  // "CSNP"
+#define SNAPSHOT_VERSION    2
+
+enum SnapshotFlags {
+    SNAPSHOT_QUANTIZED = 1,     // positions as 16 bits over their bounding box, colors as 8 bits
+    SNAPSHOT_PERIODIC = 2       // the world wraps around the borders
+};
+
+// Input outside the system that a replay needs as well
+struct SceneState {
+
+    SceneState() : forceCenter(ci::Vec2f::zero()) {};
+
+    ci::Vec2f   forceCenter;
+};
+
+// Appends plain values to a byte buffer
+class ByteWriter {
+
+    std::vector< uint8_t > & bytes;
+
+public:
+
+    explicit ByteWriter(std::vector< uint8_t > & bytes) : bytes(bytes) {};
+
+    template< typename T >
+    void put(const T & value) {
+        size_t offset = bytes.size();
+        bytes.resize(offset + sizeof(T));
+        memcpy(&bytes[offset], &value, sizeof(T));
+    };
+    void put(const ci::Vec2f & value) { put(value.x); put(value.y); };
+};
+
+// Reads plain values back; running past the end leaves the target alone
+// and clears ok()
+class ByteReader {
+
+    const uint8_t *     data;
+    size_t              size;
+    size_t              offset;
+    bool                valid;
+
+public:
+
+    ByteReader(const uint8_t * data, size_t size) :
+        data(data), size(size), offset(0), valid(true) {};
+
+    template< typename T >
+    bool get(T & value) {
+        if (! valid || size - offset < sizeof(T))
+            return valid = false;
+        memcpy(&value, data + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+    };
+    bool get(ci::Vec2f & value) { return get(value.x) && get(value.y); };
+
+    bool ok() const { return valid; };
+    size_t position() const { return offset; };
+};
+
+void writeSnapshot(std::vector< uint8_t > & bytes, const ParticleSystem & system,
+                   const SceneState & scene, bool quantize = false);
+
+// Replaces everything in `system`; false, leaving it cleared, on a
+// malformed or unsupported snapshot
+bool readSnapshot(const uint8_t * data, size_t size, ParticleSystem & system, SceneState & scene);
@@ -0,0 +1,283 @@
+#include "SpatialGrid.h"
+
+#include <algorithm>
+
+// Upper bound on cells per particle; a few stray particles far away from
+// the rest would otherwise blow up the cell count.
+#define MAX_CELLS_PER_PARTICLE  4
+
+// Stands in for a forgotten entry's particle
+#define FORGOTTEN_PARTICLE      UINT32_MAX
+
+SpatialGrid::SpatialGrid()
+{
+    origin = ci::Vec2f::zero();
+    period = ci::Vec2f::zero();
+    cellSize = 1.f;
+    cellWidth = 1.f;
+    cellHeight = 1.f;
+    cols = 0;
+    rows = 0;
+    forgotten = 0;
+}
+
+void SpatialGrid::clear()
+{
+    cellStart.clear();
+    particleCell.clear();
+    cellParticles.clear();
+    forgotten = 0;
+    cellX.clear();
+    cellY.clear();
+    cellVelocityX.clear();
+    cellVelocityY.clear();
+    cols = 0;
+    rows = 0;
+}
+
+// Into the world a periodic grid covers, however far out the position was
+ci::Vec2f SpatialGrid::wrap(const ci::Vec2f & position) const
+{
+    return ci::Vec2f(position.x - period.x * ci::math<float>::floor((position.x - origin.x) / period.x),
+                     position.y - period.y * ci::math<float>::floor((position.y - origin.y) / period.y));
+}
+
+int SpatialGrid::cellIndex(const ci::Vec2f & position) const
+{
+    ci::Vec2f at = period.x > 0.f ? wrap(position) : position;
+    int cx = (int)((at.x - origin.x) / cellWidth);
+    int cy = (int)((at.y - origin.y) / cellHeight);
+    cx = ci::math<int>::clamp(cx, 0, cols - 1);
+    cy = ci::math<int>::clamp(cy, 0, rows - 1);
+    return cy * cols + cx;
+}
+
+void SpatialGrid::build(const std::vector< ci::Vec2f > & positions,
+                        const std::vector< ci::Vec2f > & velocities, float cellSize,
+                        const WorldBounds & world)
+{
+    build(positions, velocities, NULL, positions.size(), cellSize, world);
+}
+
+void SpatialGrid::build(const std::vector< ci::Vec2f > & positions,
+                        const std::vector< ci::Vec2f > & velocities,
+                        const std::vector< uint32_t > & members, float cellSize,
+                        const WorldBounds & world)
+{
+    build(positions, velocities, members.data(), members.size(), cellSize, world);
+}
+
+// Entry k is particle members[k], or particle k without a member list
+void SpatialGrid::build(const std::vector< ci::Vec2f > & positions,
+                        const std::vector< ci::Vec2f > & velocities,
+                        const uint32_t * members, size_t count, float cellSize,
+                        const WorldBounds & world)
+{
+    if (count == 0){
+        clear();
+        return;
+    }
+
+    bool wraps = world.wraps();
+    ci::Vec2f minPos, extent;
+    if (wraps){
+        minPos = world.rect.getUpperLeft();
+        extent = world.rect.getSize();
+    } else {
+        minPos = positions[members ? members[0] : 0];
+        ci::Vec2f maxPos = minPos;
+        for (size_t k = 0; k < count; k++){
+            const ci::Vec2f & position = positions[members ? members[k] : k];
+            minPos.x = ci::math<float>::min(minPos.x, position.x);
+            minPos.y = ci::math<float>::min(minPos.y, position.y);
+            maxPos.x = ci::math<float>::max(maxPos.x, position.x);
+            maxPos.y = ci::math<float>::max(maxPos.y, position.y);
+        }
+        extent = maxPos - minPos;
+    }
+
+    float maxCells = (float)(count * MAX_CELLS_PER_PARTICLE);
+    float minCellSize = ci::math<float>::sqrt(extent.x * extent.y / maxCells);
+    minCellSize = ci::math<float>::max(minCellSize, ci::math<float>::max(extent.x, extent.y) / maxCells);
+
+    // Also rejects NaN coming from uninitialized flocking distances
+    if (!(cellSize >= minCellSize)) cellSize = minCellSize;
+    if (!(cellSize > 0.f)) cellSize = 1.f;
+
+    this->origin = minPos;
+    this->cellSize = cellSize;
+    if (wraps){
+        // Whole cells across the world, a little larger than asked for,
+        // so that the columns and rows wrap around along with it
+        cols = ci::math<int>::max((int)(extent.x / cellSize), 1);
+        rows = ci::math<int>::max((int)(extent.y / cellSize), 1);
+        cellWidth = extent.x / cols;
+        cellHeight = extent.y / rows;
+        period = extent;
+    } else {
+        cols = (int)(extent.x / cellSize) + 1;
+        rows = (int)(extent.y / cellSize) + 1;
+        cellWidth = cellSize;
+        cellHeight = cellSize;
+        period = ci::Vec2f::zero();
+    }
+
+    // Counting sort of particles by cell
+    cellStart.assign(cols * rows + 1, 0);
+    particleCell.resize(count);
+    for (size_t k = 0; k < count; k++){
+        particleCell[k] = cellIndex(positions[members ? members[k] : k]);
+        cellStart[particleCell[k] + 1]++;
+    }
+    for (size_t c = 1; c < cellStart.size(); c++)
+        cellStart[c] += cellStart[c - 1];
+
+    cellParticles.resize(count);
+    forgotten = 0;
+    for (size_t k = 0; k < count; k++)
+        cellParticles[cellStart[particleCell[k]]++] = members ? members[k] : (uint32_t)k;
+
+    // Shift the start offsets back after using them as insert cursors
+    for (size_t c = cellStart.size() - 1; c > 0; c--)
+        cellStart[c] = cellStart[c - 1];
+    cellStart[0] = 0;
+
+    cellX.resize(count);
+    cellY.resize(count);
+    cellVelocityX.resize(count);
+    cellVelocityY.resize(count);
+    for (size_t entry = 0; entry < cellParticles.size(); entry++){
+        uint32_t i = cellParticles[entry];
+        ci::Vec2f position = wraps ? wrap(positions[i]) : positions[i];
+        cellX[entry] = position.x;
+        cellY[entry] = position.y;
+        cellVelocityX[entry] = velocities[i].x;
+        cellVelocityY[entry] = velocities[i].y;
+    }
+}
+
+// Rounds towards negative infinity, unlike integer division
+static int floorDivide(int a, int b)
+{
+    return a >= 0 ? a / b : -((b - 1 - a) / b);
+}
+
+// Calls visit(firstCell, lastCell, shift) for each run of cells in a row
+// within `radius` of `position` in a periodic grid. A grid fewer cells
+// across than the reach comes up around again at the next image if
+// `repeat`, and otherwise just once with shifts that mean nothing.
+template< typename Visit >
+void SpatialGrid::forWrappedRuns(const ci::Vec2f & position, float radius, bool repeat,
+                                 const Visit & visit) const
+{
+    ci::Vec2f inside = wrap(position);
+    ci::Vec2f base = position - inside;
+    int cx = ci::math<int>::clamp((int)((inside.x - origin.x) / cellWidth), 0, cols - 1);
+    int cy = ci::math<int>::clamp((int)((inside.y - origin.y) / cellHeight), 0, rows - 1);
+    int reachX = (int)ci::math<float>::ceil(radius / cellWidth);
+    int reachY = (int)ci::math<float>::ceil(radius / cellHeight);
+
+    int firstCol = cx - reachX, lastCol = cx + reachX;
+    int firstRow = cy - reachY, lastRow = cy + reachY;
+    if (! repeat){
+        lastCol = ci::math<int>::min(lastCol, firstCol + cols - 1);
+        lastRow = ci::math<int>::min(lastRow, firstRow + rows - 1);
+    }
+
+    for (int v = firstRow; v <= lastRow; v++){
+        int turnsY = floorDivide(v, rows);
+        int rowStart = (v - turnsY * rows) * cols;
+        float shiftY = base.y + turnsY * period.y;
+
+        // Split where the row wraps around
+        for (int u = firstCol; u <= lastCol; ){
+            int turnsX = floorDivide(u, cols);
+            int x = u - turnsX * cols;
+            int run = ci::math<int>::min(lastCol - u, cols - 1 - x);
+            visit(rowStart + x, rowStart + x + run, ci::Vec2f(base.x + turnsX * period.x, shiftY));
+            u += run + 1;
+        }
+    }
+}
+
+void SpatialGrid::query(const ci::Vec2f & position, std::vector< uint32_t > & neighbors) const
+{
+    query(position, cellSize, neighbors);
+}
+
+// Candidates from every cell overlapping the square of half-size `radius`
+// around `position`; callers still need their own distance test.
+void SpatialGrid::query(const ci::Vec2f & position, float radius, std::vector< uint32_t > & neighbors) const
+{
+    neighbors.clear();
+    if (cols == 0) return;
+
+    if (period.x > 0.f){
+        forWrappedRuns(position, radius, false, [&](int firstCell, int lastCell, const ci::Vec2f &){
+            neighbors.insert(neighbors.end(), cellParticles.begin() + cellStart[firstCell],
+                             cellParticles.begin() + cellStart[lastCell + 1]);
+        });
+    } else {
+        queryRows(position, radius, neighbors);
+    }
+    if (forgotten > 0)
+        neighbors.erase(std::remove(neighbors.begin(), neighbors.end(), (uint32_t)FORGOTTEN_PARTICLE),
+                        neighbors.end());
+}
+
+void SpatialGrid::forgetEntry(int entry)
+{
+    cellParticles[entry] = FORGOTTEN_PARTICLE;
+    forgotten++;
+}
+
+// The index query's rows of cells in a grid that doesn't wrap
+void SpatialGrid::queryRows(const ci::Vec2f & position, float radius, std::vector< uint32_t > & neighbors) const
+{
+    int reach = (int)ci::math<float>::ceil(radius / cellSize);
+    int cell = cellIndex(position);
+    int cx = cell % cols;
+    int cy = cell / cols;
+
+    int firstCol = ci::math<int>::max(cx - reach, 0);
+    int lastCol = ci::math<int>::min(cx + reach, cols - 1);
+
+    for (int y = ci::math<int>::max(cy - reach, 0); y <= ci::math<int>::min(cy + reach, rows - 1); y++){
+        int rowStart = y * cols;
+        int first = cellStart[rowStart + firstCol];
+        int last = cellStart[rowStart + lastCol + 1];
+        neighbors.insert(neighbors.end(), cellParticles.begin() + first, cellParticles.begin() + last);
+    }
+}
+
+// Same cells as the index query, as one span of cell-ordered entries per row,
+// or per run of a row between the edges of a periodic grid
+void SpatialGrid::query(const ci::Vec2f & position, float radius, std::vector< GridSpan > & spans) const
+{
+    spans.clear();
+    if (cols == 0) return;
+
+    if (period.x > 0.f){
+        forWrappedRuns(position, radius, true, [&](int firstCell, int lastCell, const ci::Vec2f & shift){
+            GridSpan span = { cellStart[firstCell], cellStart[lastCell + 1], shift };
+            if (span.end > span.begin)
+                spans.push_back(span);
+        });
+        return;
+    }
+
+    int reach = (int)ci::math<float>::ceil(radius / cellSize);
+    int cell = cellIndex(position);
+    int cx = cell % cols;
+    int cy = cell / cols;
+
+    int firstCol = ci::math<int>::max(cx - reach, 0);
+    int lastCol = ci::math<int>::min(cx + reach, cols - 1);
+
+    for (int y = ci::math<int>::max(cy - reach, 0); y <= ci::math<int>::min(cy + reach, rows - 1); y++){
+        int rowStart = y * cols;
+        GridSpan span = { cellStart[rowStart + firstCol], cellStart[rowStart + lastCol + 1], ci::Vec2f::zero() };
+        if (span.end > span.begin)
+            spans.push_back(span);
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "cinder/Vector.h"
+
+#include "WorldBounds.h"
+
+#include <vector>
+#include <cstdint>
+
+// Uniform grid of particle indices over their bounding box, rebuilt once per
+// frame with a counting sort. Cell size must be at least the largest
+// interaction radius so that a 3x3 block of cells covers every neighbor.
+//
+// Positions and velocities are also copied in cell order, so the particles
+// of a run of cells in one row sit next to each other for the SIMD kernels.
+//
+// Over a periodic world the grid covers the world itself in whole cells
+// and queries wrap around its edges; the copies are of the positions
+// wrapped into the world.
+
+// Range of cell-ordered entries, see SpatialGrid::query(). Adding `shift`
+// to their positions gives their images nearest the query point; it's
+// zero unless the grid wraps. In a world narrower than twice the query
+// radius, the same entries may come up again at another image.
+struct GridSpan {
+    int         begin, end;
+    ci::Vec2f   shift;
+};
+
+class SpatialGrid {
+
+    std::vector< int >          cellStart;
+    std::vector< int >          particleCell;
+    std::vector< uint32_t >     cellParticles;
+    size_t                      forgotten;
+
+    // Cells are cellSize square unless they have to tile a periodic world
+    float                       cellWidth, cellHeight;
+
+    // The world's size when the grid wraps around it, zero otherwise
+    ci::Vec2f                   period;
+
+    ci::Vec2f wrap(const ci::Vec2f & position) const;
+    int cellIndex(const ci::Vec2f & position) const;
+    void build(const std::vector< ci::Vec2f > & positions,
+               const std::vector< ci::Vec2f > & velocities,
+               const uint32_t * members, size_t count, float cellSize,
+               const WorldBounds & world);
+    template< typename Visit >
+    void forWrappedRuns(const ci::Vec2f & position, float radius, bool repeat,
+                        const Visit & visit) const;
+    void queryRows(const ci::Vec2f & position, float radius, std::vector< uint32_t > & neighbors) const;
+
+public:
+
+    SpatialGrid();
+
+    void build(const std::vector< ci::Vec2f > & positions,
+               const std::vector< ci::Vec2f > & velocities, float cellSize,
+               const WorldBounds & world = WorldBounds());
+
+    // Only the particles at `members`; queries still return their indices
+    // into `positions`
+    void build(const std::vector< ci::Vec2f > & positions,
+               const std::vector< ci::Vec2f > & velocities,
+               const std::vector< uint32_t > & members, float cellSize,
+               const WorldBounds & world = WorldBounds());
+    void query(const ci::Vec2f & position, std::vector< uint32_t > & neighbors) const;
+    void query(const ci::Vec2f & position, float radius, std::vector< uint32_t > & neighbors) const;
+    void query(const ci::Vec2f & position, float radius, std::vector< GridSpan > & spans) const;
+    void clear();
+
+    // Edits between builds, for particles removed from `positions` or moved
+    // to another index in it. Only index queries see them; span queries and
+    // the cell-ordered copies keep what was built.
+    void forgetEntry(int entry);
+    void renumberEntry(int entry, uint32_t index) { cellParticles[entry] = index; };
+
+    // Cell-ordered copies; entry i belongs to particle cellParticle(i)
+    std::vector< float >        cellX, cellY;
+    std::vector< float >        cellVelocityX, cellVelocityY;
+
+    uint32_t cellParticle(int entry) const { return cellParticles[entry]; };
+
+    ci::Vec2f   origin;
+    float       cellSize;
+    int         cols, rows;
+};
@@ -1,7 +1,22 @@
 #include "Spring.h"
 
+#include <algorithm>
+#include <cmath>
 
-Spring::Spring(Particle *particleA, Particle *particleB, float rest, float strength)
+
+#define DEFAULT_SPRING_CAPACITY     65536
+
+// Springs per worker below which a color isn't worth splitting
+#define SPRING_PARALLEL_MIN         256
+
+// Strength for a fraction dt of a step such that 1/dt such passes relax as
+// much as one full-strength pass
+static float stepStrength(float strength, float dt)
+{
+    return dt == 1.f ? strength : 1.f - std::pow(1.f - strength, dt);
+}
+
+Spring::Spring(ParticleHandle particleA, ParticleHandle particleB, float rest, float strength)
 {
     this->particleA = particleA;
     this->particleB = particleB;
@@ -9,33 +24,229 @@ Spring::Spring(Particle *particleA, Particle *particleB, float rest, float stren
     this->strength = strength;
 }
 
-void Spring::update()
+void Spring::update(ParticleStore & particles, const WorldBounds & world, float dt)
 {
-    ci::Vec2f delta = particleA->position - particleB->position;
+    size_t a = particles.indexOf(particleA);
+    size_t b = particles.indexOf(particleB);
+    ci::Vec2f & positionA = particles.position[a];
+    ci::Vec2f & positionB = particles.position[b];
+
+    ci::Vec2f delta = world.shortest(positionA - positionB);
     float length = delta.length();
-    float invMassA = 1.0f / particleA->mass;
-    float invMassB = 1.0f / particleB->mass;
+    float invMassA = 1.0f / particles.mass[a];
+    float invMassB = 1.0f / particles.mass[b];
     float normDist = (length - rest) / (length * (invMassA +
-                                                     invMassB)) * strength;
-    particleA->position -= delta * normDist * invMassA;
-    particleB->position += delta * normDist * invMassB;
+                                                     invMassB)) * stepStrength(strength, dt);
+    positionA -= delta * normDist * invMassA;
+    positionB += delta * normDist * invMassB;
+}
+
+SpringStore::SpringStore()
+{
+    setCapacity(DEFAULT_SPRING_CAPACITY);
+}
+
+SpringHandle SpringStore::add(const Spring & spring, uint8_t color)
+{
+    SpringHandle handle = handles.acquire();
+    if (handles.isValid(handle)){
+        springs.push_back(spring);
+        springColors.push_back(takeColor(spring, color));
+        orderStale = true;
+    }
+    return handle;
+}
+
+void SpringStore::remove(SpringHandle handle)
+{
+    if (! handles.isValid(handle))
+        return;
+
+    size_t index = handles.release(handle);
+    releaseColor(springs[index], springColors[index]);
+    springs[index] = springs.back();
+    springs.pop_back();
+    springColors[index] = springColors.back();
+    springColors.pop_back();
+    orderStale = true;
 }
 
-void Spring::draw()
+uint8_t SpringStore::takeColor(const Spring & spring, uint8_t preferred)
 {
-    float distBetweenParticles = particleA->position.distance(particleB->position);
-    float distancePercent = 1.f - (distBetweenParticles / 100.f);
+    size_t slots = std::max(spring.particleA.index, spring.particleB.index) + 1;
+    if (particleColors.size() < slots)
+        particleColors.resize(slots, 0);
+
+    uint64_t & colorsA = particleColors[spring.particleA.index];
+    uint64_t & colorsB = particleColors[spring.particleB.index];
+    uint64_t taken = colorsA | colorsB;
 
-    if (distancePercent > 0.f){
-        ci::Color colorFirst = ci::lerp(particleA->color, particleB->color, distancePercent);
-        ci::gl::color(ci::ColorA( colorFirst, distancePercent * .8f));
-        ci::Vec2f conVec = particleB->position - particleA->position;
-        conVec.normalize();
-        ci::gl::drawLine(particleA->position + conVec * (particleA->radius + .5f),
-                          particleB->position - conVec * (particleB->radius + .5f));
+    uint8_t color = preferred < SPRING_COLORS && ! (taken & ((uint64_t)1 << preferred)) ?
+                    preferred : freeColor(taken);
+    if (color != SPRING_UNCOLORED){
+        colorsA |= (uint64_t)1 << color;
+        colorsB |= (uint64_t)1 << color;
     }
-//
-//
-//    ci::gl::color(ci::ColorA(1.f, 1.f, 1.f, 1.f));
-//    ci::gl::drawLine(particleA->position, particleB->position);
+    return color;
+}
+
+uint8_t SpringStore::freeColor(uint64_t taken)
+{
+    for (uint8_t color = 0; color < SPRING_COLORS; color++)
+        if (! (taken & ((uint64_t)1 << color)))
+            return color;
+    return SPRING_UNCOLORED;
+}
+
+void SpringStore::releaseColor(const Spring & spring, uint8_t color)
+{
+    if (color == SPRING_UNCOLORED)
+        return;
+
+    uint64_t bit = (uint64_t)1 << color;
+    particleColors[spring.particleA.index] &= ~bit;
+    particleColors[spring.particleB.index] &= ~bit;
+}
+
+// Counting sort of the dense indices by color, redone only after springs
+// were added or removed
+void SpringStore::sortByColor()
+{
+    std::fill(batchStart, batchStart + SPRING_COLORS + 2, 0);
+    for (auto color : springColors)
+        batchStart[color + 1]++;
+    for (int color = 0; color <= SPRING_COLORS; color++)
+        batchStart[color + 1] += batchStart[color];
+
+    size_t next[SPRING_COLORS + 1];
+    std::copy(batchStart, batchStart + SPRING_COLORS + 1, next);
+    order.resize(springs.size());
+    for (size_t i = 0; i < springs.size(); i++)
+        order[next[springColors[i]]++] = (uint32_t)i;
+
+    orderStale = false;
+}
+
+// Relaxes order[begin, end), whose springs share no particle, through the
+// SIMD kernel SPRING_LANES at a time. The last few go alongside idle
+// lanes, so a spring is relaxed the same wherever it falls in its color.
+// The kernel gets the image of b nearest a, which goes back by the same
+// shift afterwards.
+void SpringStore::relax(ParticleStore & particles, const WorldBounds & world,
+                        size_t begin, size_t end, float dt)
+{
+    size_t ends[2 * SPRING_LANES];
+    ci::Vec2f shifts[SPRING_LANES];
+    SpringLanes lanes;
+
+    for (size_t first = begin; first < end; first += SPRING_LANES){
+        int active = (int)std::min< size_t >(SPRING_LANES, end - first);
+        for (int lane = 0; lane < SPRING_LANES; lane++){
+            if (lane >= active){
+                // Zero length, which the kernel leaves where it is
+                lanes.ax[lane] = lanes.ay[lane] = lanes.bx[lane] = lanes.by[lane] = 0.f;
+                lanes.invMassA[lane] = lanes.invMassB[lane] = 1.f;
+                lanes.rest[lane] = lanes.strength[lane] = 0.f;
+                continue;
+            }
+            const Spring & spring = springs[order[first + lane]];
+            size_t a = particles.indexOf(spring.particleA);
+            size_t b = particles.indexOf(spring.particleB);
+            ends[2 * lane] = a;
+            ends[2 * lane + 1] = b;
+            shifts[lane] = world.imageShift(particles.position[b] - particles.position[a]);
+            lanes.ax[lane] = particles.position[a].x;
+            lanes.ay[lane] = particles.position[a].y;
+            lanes.bx[lane] = particles.position[b].x + shifts[lane].x;
+            lanes.by[lane] = particles.position[b].y + shifts[lane].y;
+            lanes.invMassA[lane] = 1.f / particles.mass[a];
+            lanes.invMassB[lane] = 1.f / particles.mass[b];
+            lanes.rest[lane] = spring.rest;
+            lanes.strength[lane] = stepStrength(spring.strength, dt);
+        }
+
+        relaxSprings(lanes);
+
+        for (int lane = 0; lane < active; lane++){
+            particles.position[ends[2 * lane]] = ci::Vec2f(lanes.ax[lane], lanes.ay[lane]);
+            particles.position[ends[2 * lane + 1]] = ci::Vec2f(lanes.bx[lane], lanes.by[lane]) - shifts[lane];
+        }
+    }
+}
+
+// Colors run one after another
+void SpringStore::update(ParticleStore & particles, const WorldBounds & world, float dt,
+                         int iterations, ThreadPool * pool)
+{
+    for (int iteration = 0; iteration < iterations; iteration++)
+        for (int color = nextColor(0); color <= SPRING_UNCOLORED; color = nextColor(color + 1))
+            relaxColor(particles, world, color, dt, pool);
+}
+
+int SpringStore::nextColor(int color)
+{
+    if (orderStale)
+        sortByColor();
+
+    color = std::max(color, 0);
+    while (color <= SPRING_UNCOLORED && batchStart[color + 1] == batchStart[color])
+        color++;
+    return color;
+}
+
+// A color is split across the pool only when it has enough springs to
+// outweigh waking the workers; the uncolored rest always runs one by one
+// on the calling thread.
+void SpringStore::relaxColor(ParticleStore & particles, const WorldBounds & world, int color,
+                             float dt, ThreadPool * pool)
+{
+    if (orderStale)
+        sortByColor();
+    if (color < 0 || color > SPRING_UNCOLORED)
+        return;
+
+    size_t begin = batchStart[color];
+    size_t count = batchStart[color + 1] - begin;
+    if (color == SPRING_UNCOLORED){
+        for (size_t i = begin; i < begin + count; i++)
+            springs[order[i]].update(particles, world, dt);
+    } else if (pool && count >= SPRING_PARALLEL_MIN * pool->size()){
+        pool->parallelFor(count, [&](size_t, size_t first, size_t last){
+            relax(particles, world, begin + first, begin + last, dt);
+        });
+    } else if (count > 0){
+        relax(particles, world, begin, begin + count, dt);
+    }
+}
+
+// Colors in use, not counting the uncolored overflow
+size_t SpringStore::colorCount() const
+{
+    uint8_t highest = 0;
+    for (auto color : springColors)
+        if (color != SPRING_UNCOLORED)
+            highest = std::max< uint8_t >(highest, color + 1);
+    return highest;
+}
+
+void SpringStore::clear()
+{
+    handles.clear();
+    springs.clear();
+    springColors.clear();
+    std::fill(particleColors.begin(), particleColors.end(), 0);
+    orderStale = true;
+}
+
+// particleCapacity, when known, sizes the per-particle colors up front
+void SpringStore::setCapacity(size_t capacity, size_t particleCapacity)
+{
+    handles.setCapacity(capacity);
+    springs.clear();
+    springs.reserve(capacity);
+    springColors.clear();
+    springColors.reserve(capacity);
+    order.reserve(capacity);
+    particleColors.assign(std::max(particleCapacity, particleColors.size()), 0);
+    orderStale = true;
 }
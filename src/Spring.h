@@ -1,18 +1,107 @@
 #pragma once
 
 #include "Particle.h"
-#include "cinder/gl/gl.h"
+#include "HandlePool.h"
+#include "WorldBounds.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+
+// Springs are split into at most this many colors; a spring whose
+// particles already use them all is relaxed on its own after the rest
+#define SPRING_COLORS       64
+#define SPRING_UNCOLORED    SPRING_COLORS
+#define SPRING_ANY_COLOR    0xff
 
 
 class Spring {
 
 public:
 
-    Spring(Particle *particleA, Particle *particleB, float rest, float strength);
-    void update();
-    void draw();
+    Spring() {};
+    Spring(ParticleHandle particleA, ParticleHandle particleB, float rest, float strength);
+    void update(ParticleStore & particles, const WorldBounds & world, float dt = 1.f);
 
-    Particle *particleA;
-    Particle *particleB;
+    ParticleHandle particleA;
+    ParticleHandle particleB;
     float strength, rest;
 };
+
+// Fixed-capacity, densely packed spring pool with generation-checked handles.
+//
+// Every spring gets a color on insertion, the lowest one neither of its
+// particles has yet, so the springs of one color share no particle and can
+// be relaxed at the same time. update() goes color by color, which is still
+// a Gauss-Seidel pass, just in a different order.
+class SpringStore {
+
+    HandlePool              handles;
+    std::vector< Spring >   springs;
+    std::vector< uint8_t >  springColors;
+
+    // Colors taken at each particle, indexed by particle handle slot
+    std::vector< uint64_t > particleColors;
+
+    // Dense spring indices sorted by color; batch c is
+    // [batchStart[c], batchStart[c + 1])
+    std::vector< uint32_t > order;
+    size_t                  batchStart[SPRING_COLORS + 2];
+    bool                    orderStale;
+
+    uint8_t takeColor(const Spring & spring, uint8_t preferred);
+    void releaseColor(const Spring & spring, uint8_t color);
+    void sortByColor();
+    void relax(ParticleStore & particles, const WorldBounds & world, size_t begin, size_t end, float dt);
+
+public:
+
+    SpringStore();
+
+    // `color` is taken if both particles still have it free, as when
+    // restoring a snapshot; otherwise the lowest free one
+    SpringHandle add(const Spring & spring, uint8_t color = SPRING_ANY_COLOR);
+    void remove(SpringHandle handle);
+    void clear();
+    void setCapacity(size_t capacity, size_t particleCapacity = 0);
+
+    // Relaxes every spring `iterations` times, spreading each color over
+    // `pool` when one is given. Springs pull along the shortest way
+    // between their particles in `world`.
+    void update(ParticleStore & particles, const WorldBounds & world, float dt = 1.f,
+                int iterations = 1, ThreadPool * pool = NULL);
+
+    // One color of such a pass, for callers that have to do something
+    // between colors. nextColor() is the lowest color from `color` on that
+    // has springs, SPRING_UNCOLORED for the uncolored rest, or above that
+    // once there are none.
+    int nextColor(int color);
+    void relaxColor(ParticleStore & particles, const WorldBounds & world, int color,
+                    float dt = 1.f, ThreadPool * pool = NULL);
+
+    size_t colorCount() const;
+    uint8_t colorOf(size_t index) const { return springColors[index]; };
+
+    // Colors the springs of a particle take, as bits, and the color a new
+    // spring gets between particles taking `taken` between them
+    uint64_t colorsAt(ParticleHandle particle) const {
+        return particle.index < particleColors.size() ? particleColors[particle.index] : 0;
+    };
+    static uint8_t freeColor(uint64_t taken);
+
+    bool isValid(SpringHandle handle) const { return handles.isValid(handle); };
+    size_t indexOf(SpringHandle handle) const { return handles.denseIndex(handle); };
+    SpringHandle handleAt(size_t index) const { return handles.handleAt(index); };
+
+    size_t size() const { return springs.size(); };
+    size_t capacity() const { return handles.capacity(); };
+    bool empty() const { return springs.empty(); };
+    bool full() const { return handles.full(); };
+
+    Spring & operator[](size_t index) { return springs[index]; };
+    const Spring & operator[](size_t index) const { return springs[index]; };
+
+    std::vector< Spring >::iterator begin() { return springs.begin(); };
+    std::vector< Spring >::iterator end() { return springs.end(); };
+    std::vector< Spring >::const_iterator begin() const { return springs.begin(); };
+    std::vector< Spring >::const_iterator end() const { return springs.end(); };
+};
@@ -0,0 +1,83 @@
+#include "SpriteBatch.h"
+
+
+#define DEFAULT_SPRITE_CAPACITY     8192
+
+// particle.png's disc reaches half opacity at about .74 of its half-size,
+// the generated ring is centered on .75 of it
+#define DISC_SPRITE_SCALE   1.35f
+
+const ci::Rectf SpriteBatch::DISC_COORDS(0.f, 0.f, .5f, 1.f);
+const ci::Rectf SpriteBatch::HALO_COORDS(.5f, 0.f, 1.f, 1.f);
+const float SpriteBatch::RING_RADIUS = .75f;
+const float SpriteBatch::RING_HALF_WIDTH = .15f;
+
+SpriteBatch::SpriteBatch()
+{
+    setCapacity(DEFAULT_SPRITE_CAPACITY);
+}
+
+void SpriteBatch::clear()
+{
+    vertices.clear();
+}
+
+// Sprites past the capacity are dropped until it is raised
+void SpriteBatch::setCapacity(size_t sprites)
+{
+    maxSprites = sprites;
+    vertices.clear();
+    vertices.reserve(sprites * 6);
+}
+
+void SpriteBatch::add(const ci::Vec2f & center, float halfSize,
+                      const ci::Rectf & texCoords, const ci::ColorA & color)
+{
+    if (full())
+        return;
+
+    SpriteVertex corners[4];
+    corners[0].position = center + ci::Vec2f(-halfSize, -halfSize);
+    corners[0].texCoord = ci::Vec2f(texCoords.x1, texCoords.y1);
+    corners[1].position = center + ci::Vec2f(halfSize, -halfSize);
+    corners[1].texCoord = ci::Vec2f(texCoords.x2, texCoords.y1);
+    corners[2].position = center + ci::Vec2f(halfSize, halfSize);
+    corners[2].texCoord = ci::Vec2f(texCoords.x2, texCoords.y2);
+    corners[3].position = center + ci::Vec2f(-halfSize, halfSize);
+    corners[3].texCoord = ci::Vec2f(texCoords.x1, texCoords.y2);
+    for (auto & corner : corners)
+        corner.color = color;
+
+    vertices.push_back(corners[0]);
+    vertices.push_back(corners[1]);
+    vertices.push_back(corners[2]);
+    vertices.push_back(corners[0]);
+    vertices.push_back(corners[2]);
+    vertices.push_back(corners[3]);
+}
+
+// Same sizes and colors as the circles ParticleRenderer falls back to,
+// disc then halo per particle
+void SpriteBatch::pack(const ParticleStore & particles)
+{
+    pack(particles, particles.position);
+}
+
+void SpriteBatch::pack(const ParticleStore & particles, const std::vector< ci::Vec2f > & positions)
+{
+    pack(positions, particles.color, particles.radius);
+}
+
+void SpriteBatch::pack(const std::vector< ci::Vec2f > & positions,
+                       const std::vector< ci::Color > & colors, const std::vector< float > & radii)
+{
+    vertices.clear();
+    for (size_t i = 0; i < positions.size(); i++){
+        const ci::Vec2f & position = positions[i];
+        const ci::Color & color = colors[i];
+        float radius = radii[i];
+
+        add(position, radius * .8f * DISC_SPRITE_SCALE, DISC_COORDS, ci::ColorA(color, 1.f));
+        add(position, radius * 1.2f / RING_RADIUS, HALO_COORDS, ci::ColorA(color, .7f));
+    }
+}
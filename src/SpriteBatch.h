@@ -0,0 +1,54 @@
+#pragma once
+
+#include "cinder/Vector.h"
+#include "cinder/Color.h"
+#include "cinder/Rect.h"
+
+#include "ParticleStore.h"
+
+#include <vector>
+
+// Interleaved vertex as laid out for glVertexPointer/glTexCoordPointer/
+// glColorPointer
+struct SpriteVertex {
+    ci::Vec2f   position;
+    ci::Vec2f   texCoord;
+    ci::ColorA  color;
+};
+
+// Textured quads for every particle's disc and halo, packed into one
+// preallocated vertex buffer (two triangles per sprite) and drawn with a
+// single call against the atlas from ParticleRenderer::makeAtlas(). Packing
+// doesn't touch GL.
+class SpriteBatch {
+
+    std::vector< SpriteVertex > vertices;
+    size_t                      maxSprites;
+
+public:
+
+    SpriteBatch();
+
+    void pack(const ParticleStore & particles);
+    void pack(const ParticleStore & particles, const std::vector< ci::Vec2f > & positions);
+    void pack(const std::vector< ci::Vec2f > & positions,
+              const std::vector< ci::Color > & colors, const std::vector< float > & radii);
+    void add(const ci::Vec2f & center, float halfSize,
+             const ci::Rectf & texCoords, const ci::ColorA & color);
+    void clear();
+    void setCapacity(size_t sprites);
+
+    const SpriteVertex * data() const { return vertices.data(); };
+    size_t vertexCount() const { return vertices.size(); };
+    size_t spriteCount() const { return vertices.size() / 6; };
+    size_t capacity() const { return maxSprites; };
+    bool full() const { return spriteCount() >= maxSprites; };
+
+    // The atlas' two square cells: the disc image on the left and a ring
+    // on the right, centered RING_RADIUS of the cell's half-size out and
+    // fading out over RING_HALF_WIDTH either side of that
+    static const ci::Rectf DISC_COORDS;
+    static const ci::Rectf HALO_COORDS;
+    static const float RING_RADIUS;
+    static const float RING_HALF_WIDTH;
+};
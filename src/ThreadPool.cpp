@@ -0,0 +1,85 @@
+#include "ThreadPool.h"
+
+
+ThreadPool::ThreadPool(size_t threadCount)
+{
+    if (threadCount == 0)
+        threadCount = std::thread::hardware_concurrency();
+    if (threadCount == 0)
+        threadCount = 1;
+
+    task = NULL;
+    count = 0;
+    generation = 0;
+    pending = 0;
+    stopping = false;
+
+    for (size_t i = 0; i + 1 < threadCount; i++)
+        workers.push_back(std::thread(& ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard< std::mutex > lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto & worker : workers)
+        worker.join();
+}
+
+void ThreadPool::parallelFor(size_t count, const RangeTask & task)
+{
+    if (count == 0)
+        return;
+
+    if (workers.empty()){
+        task(0, 0, count);
+        return;
+    }
+
+    {
+        std::lock_guard< std::mutex > lock(mutex);
+        this->task = & task;
+        this->count = count;
+        pending = workers.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    runChunk(workers.size());
+
+    std::unique_lock< std::mutex > lock(mutex);
+    finished.wait(lock, [this]{ return pending == 0; });
+    this->task = NULL;
+}
+
+void ThreadPool::runChunk(size_t worker)
+{
+    size_t chunks = size();
+    size_t begin = count * worker / chunks;
+    size_t end = count * (worker + 1) / chunks;
+    if (begin < end)
+        (* task)(worker, begin, end);
+}
+
+void ThreadPool::workerLoop(size_t worker)
+{
+    size_t seen = 0;
+    for (;;){
+        {
+            std::unique_lock< std::mutex > lock(mutex);
+            wake.wait(lock, [&]{ return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+
+        runChunk(worker);
+
+        std::lock_guard< std::mutex > lock(mutex);
+        if (--pending == 0)
+            finished.notify_one();
+    }
+}
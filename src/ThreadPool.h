@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// Fixed set of worker threads for data-parallel loops. parallelFor() splits
+// a range into one contiguous chunk per thread, runs the last chunk on the
+// calling thread and returns when every chunk is done.
+class ThreadPool {
+
+public:
+
+    typedef std::function< void (size_t worker, size_t begin, size_t end) > RangeTask;
+
+    explicit ThreadPool(size_t threadCount = 0);
+    ~ThreadPool();
+
+    void parallelFor(size_t count, const RangeTask & task);
+
+    size_t size() const { return workers.size() + 1; };
+
+private:
+
+    void workerLoop(size_t worker);
+    void runChunk(size_t worker);
+
+    std::vector< std::thread >  workers;
+    std::mutex                  mutex;
+    std::condition_variable     wake;
+    std::condition_variable     finished;
+
+    const RangeTask *           task;
+    size_t                      count;
+    size_t                      generation;
+    size_t                      pending;
+    bool                        stopping;
+};
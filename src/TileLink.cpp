@@ -0,0 +1,107 @@
+#include "TileLink.h"
+
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+
+// Writing to a peer that has gone fails the exchange instead of raising
+// SIGPIPE where the flag exists
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL    0
+#endif
+
+void TileLink::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+bool TileLink::exchange(std::vector< TileLink > & links)
+{
+    std::vector< pollfd > polls;
+    std::vector< TileLink * > polled;
+
+    for (auto & link : links){
+        if (! link.isOpen())
+            continue;
+        // The count goes in front of the outbox
+        uint32_t size = (uint32_t)link.outgoing.size();
+        link.outgoing.insert(link.outgoing.begin(), (uint8_t *)& size, (uint8_t *)& size + sizeof(size));
+        link.incoming.clear();
+        link.sent = 0;
+        link.received = 0;
+    }
+
+    for (;;){
+        polls.clear();
+        polled.clear();
+        for (auto & link : links){
+            if (! link.isOpen())
+                continue;
+            bool sending = link.sent < link.outgoing.size();
+            bool receiving = link.received < sizeof(header) + (link.received >= sizeof(header) ? link.header : 0);
+            if (! sending && ! receiving)
+                continue;
+            pollfd entry;
+            entry.fd = link.fd;
+            entry.events = (short)((sending ? POLLOUT : 0) | (receiving ? POLLIN : 0));
+            entry.revents = 0;
+            polls.push_back(entry);
+            polled.push_back(& link);
+        }
+        if (polls.empty())
+            break;
+
+        if (poll(polls.data(), polls.size(), -1) < 0){
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        for (size_t i = 0; i < polls.size(); i++){
+            TileLink & link = * polled[i];
+            short events = polls[i].revents;
+            if (events & (POLLERR | POLLNVAL))
+                return false;
+
+            if (events & POLLOUT){
+                ssize_t count = send(link.fd, & link.outgoing[link.sent],
+                                     link.outgoing.size() - link.sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+                if (count < 0 && errno != EAGAIN && errno != EINTR)
+                    return false;
+                if (count > 0)
+                    link.sent += (size_t)count;
+            }
+
+            if (events & (POLLIN | POLLHUP)){
+                uint8_t * target;
+                size_t wanted;
+                if (link.received < sizeof(header)){
+                    target = (uint8_t *)& link.header + link.received;
+                    wanted = sizeof(header) - link.received;
+                } else {
+                    size_t body = link.received - sizeof(header);
+                    target = & link.incoming[body];
+                    wanted = link.header - body;
+                }
+                ssize_t count = recv(link.fd, target, wanted, MSG_DONTWAIT);
+                if (count == 0)
+                    return false;
+                if (count < 0 && errno != EAGAIN && errno != EINTR)
+                    return false;
+                if (count > 0){
+                    link.received += (size_t)count;
+                    if (link.received == sizeof(header))
+                        link.incoming.resize(link.header);
+                }
+            }
+        }
+    }
+
+    for (auto & link : links)
+        link.outgoing.clear();
+    return true;
+}
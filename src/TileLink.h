@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// One end of a stream socket to another tile process, usually half of a
+// socketpair() made before forking.
+//
+// A message is a 32-bit byte count and that many bytes. Each round every
+// process fills the outbox of each of its links and calls exchange(),
+// which sends all of them and reads one message from every link in the
+// same poll loop, so two processes writing large messages to each other
+// can't both block on a full socket.
+class TileLink {
+
+    int                     fd;
+    std::vector< uint8_t >  outgoing, incoming;
+    size_t                  sent, received;
+    uint32_t                header;
+
+public:
+
+    TileLink() : fd(-1), sent(0), received(0), header(0) {};
+    explicit TileLink(int fd) : fd(fd), sent(0), received(0), header(0) {};
+
+    void close();
+    bool isOpen() const { return fd >= 0; };
+
+    // Blocks until every open link has sent its outbox and received a
+    // message; false if one was closed or failed
+    static bool exchange(std::vector< TileLink > & links);
+
+    // The message to send next round, and the one received last round
+    std::vector< uint8_t > & outbox() { return outgoing; };
+    const std::vector< uint8_t > & inbox() const { return incoming; };
+
+    template< typename T >
+    void write(const T * values, size_t count) {
+        size_t at = outgoing.size();
+        outgoing.resize(at + count * sizeof(T));
+        if (count)
+            memcpy(& outgoing[at], values, count * sizeof(T));
+    };
+    template< typename T >
+    void write(const T & value) { write(& value, 1); };
+    template< typename T >
+    void write(const std::vector< T > & values) {
+        write((uint32_t)values.size());
+        write(values.data(), values.size());
+    };
+};
+
+// Reads what TileLink::write() put in a message, in the same order;
+// reading past the end yields nothing and fails from then on
+class TileReader {
+
+    const std::vector< uint8_t > &  message;
+    size_t                          at;
+    bool                            failed;
+
+public:
+
+    explicit TileReader(const std::vector< uint8_t > & message) :
+        message(message), at(0), failed(false) {};
+
+    template< typename T >
+    bool read(T * values, size_t count) {
+        if (failed || message.size() - at < count * sizeof(T))
+            return ! (failed = true);
+        if (count)
+            memcpy(values, & message[at], count * sizeof(T));
+        at += count * sizeof(T);
+        return true;
+    };
+    template< typename T >
+    bool read(T & value) { return read(& value, 1); };
+    template< typename T >
+    bool read(std::vector< T > & values) {
+        uint32_t count = 0;
+        if (! read(count) || message.size() - at < (size_t)count * sizeof(T))
+            return ! (failed = true);
+        values.resize(count);
+        return read(values.data(), count);
+    };
+
+    bool ok() const { return ! failed; };
+};
@@ -0,0 +1,691 @@
+#include "TileSimulation.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+
+
+// Ghosts are tracked per tile in a 64-bit mask
+#define MAX_TILES   64
+
+int TileLayout::tileAt(float x) const
+{
+    if (tiles <= 1 || ! (borders.getWidth() > 0.f))
+        return 0;
+    int at = (int)std::floor((x - borders.x1) / borders.getWidth() * tiles);
+    return ci::math<int>::clamp(at, 0, tiles - 1);
+}
+
+bool TileLayout::nearTile(float x, int tile) const
+{
+    float from = tile == 0 ? -FLT_MAX : left(tile) - halo;
+    float to = tile == tiles - 1 ? FLT_MAX : right(tile) + halo;
+    return x >= from && x < to;
+}
+
+TileSimulation::TileSimulation(ParticleSystem & system, const TileLayout & layout, int tile,
+                               std::vector< TileLink > & links) :
+    system(system), layout(layout), tile(tile), links(links)
+{
+    this->layout.tiles = ci::math<int>::clamp(layout.tiles, 1, MAX_TILES);
+    this->links.resize(this->layout.tiles);
+    maxParticles = 0;
+    seed = 0;
+    rounds = 0;
+    ownedCount = 0;
+    totalCount = 0;
+    droppedCount = 0;
+    linkFailed = false;
+
+    // Ghosts have to come from the state every tile stepped from, and be
+    // added up in the same order; the system may not evict them on its
+    // own either. They arrive once a step, so a step can't be split, and
+    // the strips don't wrap around, so neither does the world.
+    system.parallelStep = true;
+    system.canonicalOrder = true;
+    system.substeps = 1;
+    system.maxParticles = INT_MAX;
+    system.springPass = [this](float dt){ relaxSprings(dt); };
+    system.setBorders(layout.borders);
+    system.setPeriodic(false);
+
+    size_t capacity = system.particles.capacity();
+    slotId.assign(capacity, 0);
+    slotOwner.assign(capacity, -1);
+    slotSeen.assign(capacity, 0);
+    slotColors.assign(capacity, 0);
+    outgoing.resize(this->layout.tiles);
+    outgoingSpawns.resize(this->layout.tiles);
+    outgoingSprings.resize(this->layout.tiles);
+    shared.resize(this->layout.tiles);
+}
+
+TileSimulation::~TileSimulation()
+{
+    system.springPass = nullptr;
+}
+
+ParticleHandle TileSimulation::find(uint64_t id) const
+{
+    auto found = handles.find(id);
+    return found == handles.end() ? ParticleHandle() : found->second;
+}
+
+// Files a particle just added to the system under its id
+ParticleHandle TileSimulation::track(ParticleHandle handle, uint64_t id, int owner)
+{
+    slotId[handle.index] = id;
+    slotOwner[handle.index] = owner;
+    slotSeen[handle.index] = rounds;
+    slotColors[handle.index] = 0;
+    handles[id] = handle;
+    if (owner == tile)
+        ownedCount++;
+    return handle;
+}
+
+// Without springs of its own; those come from the tiles that made them
+ParticleHandle TileSimulation::insert(const TileSpawn & spawn, int owner)
+{
+    if (system.particles.full())
+        return ParticleHandle();
+
+    const ParticleSpawn & from = spawn.spawn;
+    int springsPerParticle = system.springsPerParticle;
+    system.springsPerParticle = 0;
+    ParticleHandle handle = system.addParticle(from.position, from.radius, from.mass, from.drag,
+                                               from.targetSeparation, from.neighboringDistance,
+                                               from.color);
+    system.springsPerParticle = springsPerParticle;
+    return track(handle, spawn.id, owner);
+}
+
+ParticleHandle TileSimulation::insert(const TileParticle & particle, int owner)
+{
+    TileSpawn spawn = { particle.id, ParticleSpawn(particle.position, particle.radius, particle.mass,
+                                                   particle.drag, particle.targetSeparation,
+                                                   particle.neighboringDistance, particle.color) };
+    ParticleHandle handle = insert(spawn, owner);
+    if (system.particles.isValid(handle)){
+        writeState(handle, particle);
+        slotColors[handle.index] = particle.springColors;
+    }
+    return handle;
+}
+
+void TileSimulation::writeState(ParticleHandle handle, const TileParticle & particle)
+{
+    ParticleStore & particles = system.particles;
+    size_t index = particles.indexOf(handle);
+    particles.position[index] = particle.position;
+    particles.velocity[index] = particle.velocity;
+    particles.prevPosition[index] = particle.prevPosition;
+    particles.anchor[index] = particle.anchor;
+    particles.maxSpeed[index] = particle.maxSpeed;
+    particles.maxForce[index] = particle.maxForce;
+}
+
+TileParticle TileSimulation::readState(size_t index) const
+{
+    const ParticleStore & particles = system.particles;
+    ParticleHandle handle = particles.handleAt(index);
+    TileParticle particle;
+    particle.id = slotId[handle.index];
+    particle.position = particles.position[index];
+    particle.velocity = particles.velocity[index];
+    particle.prevPosition = particles.prevPosition[index];
+    particle.anchor = particles.anchor[index];
+    particle.color = particles.color[index];
+    particle.radius = particles.radius[index];
+    particle.mass = particles.mass[index];
+    particle.drag = particles.drag[index];
+    particle.maxSpeed = particles.maxSpeed[index];
+    particle.maxForce = particles.maxForce[index];
+    particle.targetSeparation = particles.targetSeparation[index];
+    particle.neighboringDistance = particles.neighboringDistance[index];
+    particle.springColors = colorsOf(handle);
+    return particle;
+}
+
+TileSpring TileSimulation::describe(const Spring & spring) const
+{
+    TileSpring described;
+    described.a = slotId[spring.particleA.index];
+    described.b = slotId[spring.particleB.index];
+    described.rest = spring.rest;
+    described.strength = spring.strength;
+    described.color = SPRING_UNCOLORED;
+    return described;
+}
+
+// The colors of all of a particle's springs: we hold every spring of the
+// particles we own, or will once those handed over with them land, and
+// hear about the others' from their owners
+uint64_t TileSimulation::colorsOf(ParticleHandle handle) const
+{
+    if (! owns(handle))
+        return slotColors[handle.index];
+
+    uint64_t colors = system.springs.colorsAt(handle);
+    uint64_t id = slotId[handle.index];
+    for (auto & pending : pendingSprings)
+        if ((pending.spring.a == id || pending.spring.b == id) && pending.spring.color != SPRING_UNCOLORED)
+            colors |= 1ull << pending.spring.color;
+    return colors;
+}
+
+bool TileSimulation::connected(ParticleHandle a, ParticleHandle b) const
+{
+    for (auto handle : system.attachedSprings(a)){
+        const Spring & spring = system.springs[system.springs.indexOf(handle)];
+        if ((spring.particleA == a && spring.particleB == b) ||
+            (spring.particleA == b && spring.particleB == a))
+            return true;
+    }
+    return false;
+}
+
+void TileSimulation::remove(ParticleHandle handle)
+{
+    handles.erase(slotId[handle.index]);
+    if (owns(handle))
+        ownedCount--;
+    slotOwner[handle.index] = -1;
+    system.destroyParticle(handle);
+}
+
+// Frees a slot in a full store by dropping a ghost without springs; the
+// next halo exchange sends it again if it's still needed here. False if
+// every ghost holds a spring.
+bool TileSimulation::makeRoom()
+{
+    const ParticleStore & particles = system.particles;
+    for (size_t i = 0; i < particles.size(); i++){
+        ParticleHandle handle = particles.handleAt(i);
+        if (! owns(handle) && system.attachedSprings(handle).empty()){
+            remove(handle);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TileSimulation::add(uint64_t id, const ParticleSpawn & spawn)
+{
+    TileSpawn queuedSpawn = { id, spawn };
+    queued.push_back(queuedSpawn);
+}
+
+bool TileSimulation::step()
+{
+    if (! exchangeHalo())
+        return false;
+    connectPending();
+    if (! spawnQueued())
+        return false;
+    system.update();
+    if (linkFailed)
+        return false;
+    return migrate();
+}
+
+// Every tile gets the owned particles within halo of its strip or sprung
+// to one of its own, the particles spawned here this step within halo of
+// it, and how many particles we'll own with those
+bool TileSimulation::exchangeHalo()
+{
+    rounds++;
+    const ParticleStore & particles = system.particles;
+
+    // Springs handed over with a particle reach tiles that don't know
+    // where it went yet
+    targets.assign(particles.size(), 0);
+    for (auto & pending : pendingSprings){
+        ParticleHandle a = find(pending.spring.a);
+        ParticleHandle b = find(pending.spring.b);
+        if (particles.isValid(a) && owns(a) && pending.ownerB != tile)
+            targets[particles.indexOf(a)] |= 1ull << pending.ownerB;
+        if (particles.isValid(b) && owns(b) && pending.ownerA != tile)
+            targets[particles.indexOf(b)] |= 1ull << pending.ownerA;
+    }
+
+    for (int j = 0; j < layout.tiles; j++){
+        links[j].outbox().clear();
+        outgoing[j].clear();
+        outgoingSpawns[j].clear();
+    }
+    for (size_t i = 0; i < particles.size(); i++){
+        ParticleHandle handle = particles.handleAt(i);
+        if (! owns(handle))
+            continue;
+
+        for (int j = 0; j < layout.tiles; j++)
+            if (j != tile && layout.nearTile(particles.position[i].x, j))
+                targets[i] |= 1ull << j;
+        for (auto springHandle : system.attachedSprings(handle)){
+            const Spring & spring = system.springs[system.springs.indexOf(springHandle)];
+            ParticleHandle other = spring.particleA == handle ? spring.particleB : spring.particleA;
+            if (! owns(other))
+                targets[i] |= 1ull << slotOwner[other.index];
+        }
+        if (! targets[i])
+            continue;
+
+        TileParticle state = readState(i);
+        for (int j = 0; j < layout.tiles; j++)
+            if (targets[i] & (1ull << j))
+                outgoing[j].push_back(state);
+    }
+    for (auto & spawn : queued)
+        for (int j = 0; j < layout.tiles; j++)
+            if (j != tile && layout.nearTile(spawn.spawn.position.x, j))
+                outgoingSpawns[j].push_back(spawn);
+
+    uint64_t count = ownedCount + queued.size();
+    for (int j = 0; j < layout.tiles; j++){
+        if (j == tile)
+            continue;
+        links[j].write(outgoing[j]);
+        links[j].write(outgoingSpawns[j]);
+        links[j].write(count);
+    }
+    if (! TileLink::exchange(links))
+        return false;
+
+    totalCount = (size_t)count;
+    spawns = queued;
+    queued.clear();
+    for (int j = 0; j < layout.tiles; j++){
+        if (j == tile)
+            continue;
+        TileReader reader(links[j].inbox());
+        uint64_t theirs = 0;
+        reader.read(received);
+        reader.read(receivedSpawns);
+        reader.read(theirs);
+        if (! reader.ok())
+            return false;
+        totalCount += (size_t)theirs;
+        spawns.insert(spawns.end(), receivedSpawns.begin(), receivedSpawns.end());
+
+        for (auto & particle : received){
+            ParticleHandle handle = find(particle.id);
+            if (! particles.isValid(handle)){
+                insert(particle, j);
+                continue;
+            }
+            if (owns(handle))
+                continue;
+            writeState(handle, particle);
+            slotOwner[handle.index] = j;
+            slotSeen[handle.index] = rounds;
+            slotColors[handle.index] = particle.springColors;
+        }
+    }
+
+    // Ghosts nobody sent have left every halo
+    departed.clear();
+    for (size_t i = 0; i < particles.size(); i++){
+        ParticleHandle handle = particles.handleAt(i);
+        if (! owns(handle) && slotSeen[handle.index] != rounds)
+            departed.push_back(handle);
+    }
+    for (auto handle : departed)
+        remove(handle);
+    return true;
+}
+
+// Springs that came with particles handed to us land once both their
+// ends are here, which the halo exchange after the handover sees to
+void TileSimulation::connectPending()
+{
+    for (auto & pending : pendingSprings){
+        const TileSpring & spring = pending.spring;
+        ParticleHandle a = find(spring.a);
+        ParticleHandle b = find(spring.b);
+        if (! system.particles.isValid(a) || ! system.particles.isValid(b) || ! (owns(a) || owns(b)))
+            continue;
+        if (! connected(a, b) && ! system.springs.full())
+            system.addSpring(Spring(a, b, spring.rest, spring.strength), spring.color);
+    }
+    pendingSprings.clear();
+}
+
+// Spawns this step's particles of every tile near ours in id order, ours
+// with their springs, so each finds the partners it would in one process.
+// The color a spring takes depends on every spring made before it to
+// either end, anywhere, so all tiles get all new springs and color them
+// in the same order from the colors their ends had before the step. Then
+// evicts, as ParticleSystem::update() does after the spawns before it.
+bool TileSimulation::spawnQueued()
+{
+    std::sort(spawns.begin(), spawns.end(), [](const TileSpawn & a, const TileSpawn & b){
+        return a.id < b.id;
+    });
+
+    newSprings.clear();
+    for (auto & spawn : spawns){
+        int owner = layout.tileAt(spawn.spawn.position.x);
+        ParticleHandle handle = insert(spawn, owner);
+        if (! system.particles.isValid(handle)){
+            if (owner == tile)
+                droppedCount++;
+            continue;
+        }
+        if (owner != tile)
+            continue;
+
+        system.reseed(seed + (uint32_t)spawn.id);
+        system.chooseSprings(handle, chosen);
+        for (auto & spring : chosen){
+            NewSpring made = { describe(spring), colorsOf(spring.particleB) };
+            newSprings.push_back(made);
+        }
+    }
+    spawns.clear();
+
+    // Each tile's oldest are enough to find the oldest of all
+    size_t excess = maxParticles > 0 && totalCount > maxParticles ? totalCount - maxParticles : 0;
+    oldest.clear();
+    if (excess > 0){
+        for (auto & entry : handles)
+            if (owns(entry.second))
+                oldest.push_back(entry.first);
+        size_t kept = std::min(excess, oldest.size());
+        std::partial_sort(oldest.begin(), oldest.begin() + kept, oldest.end());
+        oldest.resize(kept);
+    }
+
+    for (int j = 0; j < layout.tiles; j++){
+        if (j == tile)
+            continue;
+        links[j].outbox().clear();
+        links[j].write(newSprings);
+        links[j].write(oldest);
+    }
+    if (! TileLink::exchange(links))
+        return false;
+
+    for (int j = 0; j < layout.tiles; j++){
+        if (j == tile)
+            continue;
+        TileReader reader(links[j].inbox());
+        reader.read(receivedNewSprings);
+        reader.read(receivedOldest);
+        if (! reader.ok())
+            return false;
+        newSprings.insert(newSprings.end(), receivedNewSprings.begin(), receivedNewSprings.end());
+        oldest.insert(oldest.end(), receivedOldest.begin(), receivedOldest.end());
+    }
+
+    // A particle's springs come from one tile in the order it made them,
+    // and the particles spawned before it made theirs
+    std::stable_sort(newSprings.begin(), newSprings.end(), [](const NewSpring & a, const NewSpring & b){
+        return a.spring.a < b.spring.a;
+    });
+    newColors.clear();
+    for (auto & made : newSprings){
+        TileSpring & spring = made.spring;
+        newColors.insert(std::make_pair(spring.a, (uint64_t)0));
+        newColors.insert(std::make_pair(spring.b, made.colorsB));
+        uint64_t & colorsA = newColors[spring.a];
+        uint64_t & colorsB = newColors[spring.b];
+        spring.color = SpringStore::freeColor(colorsA | colorsB);
+        if (spring.color != SPRING_UNCOLORED){
+            colorsA |= 1ull << spring.color;
+            colorsB |= 1ull << spring.color;
+        }
+
+        ParticleHandle a = find(spring.a);
+        ParticleHandle b = find(spring.b);
+        if (system.particles.isValid(a) && system.particles.isValid(b) && (owns(a) || owns(b)) &&
+            ! system.springs.full())
+            system.addSpring(Spring(a, b, spring.rest, spring.strength), spring.color);
+    }
+
+    evict(excess);
+    return true;
+}
+
+// Drops the `excess` lowest ids of those every tile sent as its oldest,
+// owned here or not
+void TileSimulation::evict(size_t excess)
+{
+    std::sort(oldest.begin(), oldest.end());
+    for (size_t i = 0; i < excess && i < oldest.size(); i++){
+        ParticleHandle handle = find(oldest[i]);
+        if (system.particles.isValid(handle))
+            remove(handle);
+    }
+}
+
+// The system's spring pass, one color after another and the same colors
+// on every tile. Before each color every tile tells the tiles holding
+// springs to its particles where those are now, so both tiles relax a
+// spring between them from the positions one process would.
+void TileSimulation::relaxSprings(float dt)
+{
+    ParticleStore & particles = system.particles;
+
+    for (auto & indices : shared)
+        indices.clear();
+    for (size_t i = 0; i < particles.size(); i++){
+        ParticleHandle handle = particles.handleAt(i);
+        if (! owns(handle))
+            continue;
+        uint64_t holders = 0;
+        for (auto springHandle : system.attachedSprings(handle)){
+            const Spring & spring = system.springs[system.springs.indexOf(springHandle)];
+            ParticleHandle other = spring.particleA == handle ? spring.particleB : spring.particleA;
+            if (! owns(other))
+                holders |= 1ull << slotOwner[other.index];
+        }
+        for (int j = 0; j < layout.tiles; j++)
+            if (holders & (1ull << j))
+                shared[j].push_back((uint32_t)i);
+    }
+
+    for (int iteration = 0; iteration < system.springIterations && ! linkFailed; iteration++){
+        int color = 0;
+        while (true){
+            int32_t next = system.springs.nextColor(color);
+            for (int j = 0; j < layout.tiles; j++){
+                if (j == tile)
+                    continue;
+                positions.clear();
+                for (auto i : shared[j]){
+                    TilePosition position = { slotId[particles.handleAt(i).index], particles.position[i] };
+                    positions.push_back(position);
+                }
+                links[j].outbox().clear();
+                links[j].write(positions);
+                links[j].write(next);
+            }
+            if (! TileLink::exchange(links)){
+                linkFailed = true;
+                return;
+            }
+
+            for (int j = 0; j < layout.tiles; j++){
+                if (j == tile)
+                    continue;
+                TileReader reader(links[j].inbox());
+                int32_t theirs = 0;
+                reader.read(receivedPositions);
+                reader.read(theirs);
+                if (! reader.ok()){
+                    linkFailed = true;
+                    return;
+                }
+                for (auto & position : receivedPositions){
+                    ParticleHandle handle = find(position.id);
+                    if (particles.isValid(handle) && ! owns(handle))
+                        particles.position[particles.indexOf(handle)] = position.position;
+                }
+                next = std::min(next, theirs);
+            }
+
+            if (next > SPRING_UNCOLORED)
+                break;
+            system.springs.relaxColor(particles, system.getWorld(), next, dt);
+            color = next + 1;
+        }
+    }
+}
+
+// Particles that left the strip go to the tile they're in now, springs
+// and all, and stay here as ghosts for the halo exchange to keep or drop.
+// Every tile hears where they went, so that it sends the particles sprung
+// to them to their new owners from the next round on.
+bool TileSimulation::migrate()
+{
+    const ParticleStore & particles = system.particles;
+
+    for (int j = 0; j < layout.tiles; j++){
+        outgoing[j].clear();
+        outgoingSprings[j].clear();
+    }
+    departed.clear();
+    departures.clear();
+    for (size_t i = 0; i < particles.size(); i++){
+        ParticleHandle handle = particles.handleAt(i);
+        if (! owns(handle))
+            continue;
+        int owner = layout.tileAt(particles.position[i].x);
+        if (owner == tile)
+            continue;
+
+        outgoing[owner].push_back(readState(i));
+        departed.push_back(handle);
+        Departure departure = { slotId[handle.index], owner };
+        departures.push_back(departure);
+    }
+
+    // Let go of them first, so the springs going along name their owners
+    for (size_t k = 0; k < departed.size(); k++){
+        slotOwner[departed[k].index] = departures[k].owner;
+        ownedCount--;
+    }
+    for (size_t k = 0; k < departed.size(); k++){
+        for (auto springHandle : system.attachedSprings(departed[k])){
+            const Spring & spring = system.springs[system.springs.indexOf(springHandle)];
+            MovedSpring moved = { describe(spring), slotOwner[spring.particleA.index],
+                                  slotOwner[spring.particleB.index] };
+            moved.spring.color = system.springs.colorOf(system.springs.indexOf(springHandle));
+            outgoingSprings[departures[k].owner].push_back(moved);
+        }
+    }
+
+    for (int j = 0; j < layout.tiles; j++){
+        if (j == tile)
+            continue;
+        links[j].outbox().clear();
+        links[j].write(outgoing[j]);
+        links[j].write(outgoingSprings[j]);
+        links[j].write(departures);
+    }
+    if (! TileLink::exchange(links))
+        return false;
+
+    newOwners.clear();
+    for (auto & departure : departures)
+        newOwners[departure.id] = departure.owner;
+    for (int j = 0; j < layout.tiles; j++){
+        if (j == tile)
+            continue;
+        TileReader reader(links[j].inbox());
+        reader.read(received);
+        reader.read(receivedSprings);
+        reader.read(receivedDepartures);
+        if (! reader.ok())
+            return false;
+
+        // The sender has already let go of these, so a particle we can't
+        // make room for is gone
+        for (auto & particle : received){
+            ParticleHandle handle = find(particle.id);
+            if (! particles.isValid(handle)){
+                if (particles.full() && ! makeRoom())
+                    droppedCount++;
+                else
+                    insert(particle, tile);
+                continue;
+            }
+            writeState(handle, particle);
+            if (! owns(handle)){
+                slotOwner[handle.index] = tile;
+                ownedCount++;
+            }
+        }
+        for (auto & moved : receivedSprings){
+            bool known = false;
+            for (auto & pending : pendingSprings)
+                known = known || (pending.spring.a == moved.spring.a && pending.spring.b == moved.spring.b);
+            if (! known)
+                pendingSprings.push_back(moved);
+        }
+        for (auto & departure : receivedDepartures){
+            newOwners[departure.id] = departure.owner;
+            ParticleHandle handle = find(departure.id);
+            if (particles.isValid(handle) && ! owns(handle) && departure.owner != tile)
+                slotOwner[handle.index] = departure.owner;
+        }
+    }
+
+    // Their senders named the owners from before this round
+    for (auto & pending : pendingSprings){
+        auto movedA = newOwners.find(pending.spring.a);
+        auto movedB = newOwners.find(pending.spring.b);
+        if (movedA != newOwners.end())
+            pending.ownerA = movedA->second;
+        if (movedB != newOwners.end())
+            pending.ownerB = movedB->second;
+    }
+
+    // Springs between two particles we no longer own are held elsewhere
+    for (auto handle : departed){
+        if (! particles.isValid(handle))
+            continue;
+        attached = system.attachedSprings(handle);
+        for (auto springHandle : attached){
+            const Spring & spring = system.springs[system.springs.indexOf(springHandle)];
+            ParticleHandle other = spring.particleA == handle ? spring.particleB : spring.particleA;
+            if (! owns(other))
+                system.destroySpring(springHandle);
+        }
+    }
+    return true;
+}
+
+void TileSimulation::collect(std::vector< TileParticle > & particles) const
+{
+    particles.clear();
+    for (size_t i = 0; i < system.particles.size(); i++)
+        if (owns(system.particles.handleAt(i)))
+            particles.push_back(readState(i));
+}
+
+// Springs handed over with a particle count from the handover on
+void TileSimulation::collectSprings(std::vector< TileSpring > & springs) const
+{
+    springs.clear();
+    for (size_t i = 0; i < system.springs.size(); i++){
+        TileSpring described = describe(system.springs[i]);
+        described.color = system.springs.colorOf(i);
+        ParticleHandle lower = find(std::min(described.a, described.b));
+        if (owns(lower))
+            springs.push_back(described);
+    }
+    for (auto & pending : pendingSprings){
+        const TileSpring & spring = pending.spring;
+        ParticleHandle lower = find(std::min(spring.a, spring.b));
+        if (! system.particles.isValid(lower) || ! owns(lower))
+            continue;
+        ParticleHandle a = find(spring.a);
+        ParticleHandle b = find(spring.b);
+        if (system.particles.isValid(a) && system.particles.isValid(b) && connected(a, b))
+            continue;
+        springs.push_back(spring);
+    }
+}
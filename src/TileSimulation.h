@@ -0,0 +1,213 @@
+#pragma once
+
+#include "cinder/Vector.h"
+#include "cinder/Color.h"
+#include "cinder/Rect.h"
+
+#include "ParticleSystem.h"
+#include "TileLink.h"
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// The borders cut into `tiles` vertical strips of equal width, which is
+// how projector walls are laid out. Positions left or right of the borders
+// belong to the outer strips.
+struct TileLayout {
+
+    TileLayout() : tiles(1), halo(0.f) {};
+    TileLayout(const ci::Rectf & borders, int tiles, float halo) :
+        borders(borders), tiles(tiles), halo(halo) {};
+
+    int tileAt(float x) const;
+    float left(int tile) const { return borders.x1 + borders.getWidth() * tile / tiles; };
+    float right(int tile) const { return borders.x1 + borders.getWidth() * (tile + 1) / tiles; };
+
+    // Whether x lies within halo of the strip of `tile`
+    bool nearTile(float x, int tile) const;
+
+    ci::Rectf   borders;
+    int         tiles;
+
+    // How far past its strip a tile sees: at least the widest flocking
+    // interaction radius and the spring radius
+    float       halo;
+};
+
+// A particle as it crosses between tiles, with the id that names it on
+// every tile and the colors its springs take
+struct TileParticle {
+    uint64_t    id;
+    ci::Vec2f   position, velocity, prevPosition, anchor;
+    ci::Color   color;
+    float       radius, mass, drag, maxSpeed, maxForce;
+    float       targetSeparation, neighboringDistance;
+    uint64_t    springColors;
+};
+
+struct TileSpring {
+    uint64_t    a, b;
+    float       rest, strength;
+    uint8_t     color;
+};
+
+// One tile of a simulation split over processes. The tile's ParticleSystem
+// holds the particles it owns, those inside its strip, plus ghost copies
+// of the particles other tiles own within halo of it or sprung to one of
+// its own.
+//
+// Each step every tile sends the others the latest state of the particles
+// they need as ghosts, along with the particles it spawns; spawns them,
+// evicts, steps its system, then hands the particles that left its strip
+// to their new owners. Done this way every step comes out as it would in
+// one process, to the bit, as long as that process spawns in id order
+// with the same seeds, sets canonicalOrder, and no particle holds
+// SPRING_COLORS springs:
+// - Flocking takes the parallel step, which moves each particle from the
+//   state the previous step left all of them in, with its sums added up
+//   in an order that only depends on its neighbors.
+// - A new particle springs to the particles spawned before it in the same
+//   step on other tiles too, and its springs take the colors one process
+//   would give them, see spawnQueued().
+// - maxParticles evicts the oldest particles of the whole simulation.
+// - Springs are relaxed one color at a time, and in between the ends of
+//   springs between tiles are brought up to date, so both tiles relax
+//   such a spring from the same positions, see relaxSprings().
+class TileSimulation {
+
+    // A particle spawned this step, sent to the tiles it's near
+    struct TileSpawn {
+        uint64_t        id;
+        ParticleSpawn   spawn;
+    };
+
+    // A spring a particle spawned this step made, with the colors its other
+    // end's springs took before the step
+    struct NewSpring {
+        TileSpring  spring;
+        uint64_t    colorsB;
+    };
+
+    // A spring that came along with a particle, and the tiles owning its
+    // ends as far as the sender knew
+    struct MovedSpring {
+        TileSpring  spring;
+        int32_t     ownerA, ownerB;
+    };
+
+    struct Departure {
+        uint64_t    id;
+        int32_t     owner;
+    };
+
+    struct TilePosition {
+        uint64_t    id;
+        ci::Vec2f   position;
+    };
+
+    ParticleSystem &            system;
+    TileLayout                  layout;
+    int                         tile;
+    std::vector< TileLink > &   links;
+
+    // Per particle handle slot: its id, the tile owning it, the last round
+    // it arrived as a ghost, and the colors of its springs on its owner
+    std::vector< uint64_t >     slotId;
+    std::vector< int >          slotOwner;
+    std::vector< uint64_t >     slotSeen;
+    std::vector< uint64_t >     slotColors;
+    std::unordered_map< uint64_t, ParticleHandle >  handles;
+
+    uint64_t                    rounds;
+    size_t                      ownedCount;
+    size_t                      totalCount;
+    size_t                      droppedCount;
+    bool                        linkFailed;
+
+    // Springs that came with particles handed to us, waiting for the ghost
+    // of their other end
+    std::vector< MovedSpring >  pendingSprings;
+
+    std::vector< TileSpawn >    queued;
+    std::vector< TileSpawn >    spawns;
+    std::vector< NewSpring >    newSprings;
+    std::vector< Spring >       chosen;
+    std::unordered_map< uint64_t, uint64_t >    newColors;
+    std::unordered_map< uint64_t, int >         newOwners;
+
+    std::vector< std::vector< TileParticle > >  outgoing;
+    std::vector< std::vector< TileSpawn > >     outgoingSpawns;
+    std::vector< std::vector< MovedSpring > >   outgoingSprings;
+    std::vector< std::vector< uint32_t > >      shared;
+    std::vector< TilePosition >             positions;
+    std::vector< TileParticle >             received;
+    std::vector< TileSpawn >                receivedSpawns;
+    std::vector< NewSpring >                receivedNewSprings;
+    std::vector< MovedSpring >              receivedSprings;
+    std::vector< Departure >                departures, receivedDepartures;
+    std::vector< TilePosition >             receivedPositions;
+    std::vector< uint64_t >                 oldest, receivedOldest;
+    std::vector< uint64_t >                 targets;
+    std::vector< SpringHandle >             attached;
+    std::vector< ParticleHandle >           departed;
+
+    bool owns(ParticleHandle handle) const { return slotOwner[handle.index] == tile; };
+    ParticleHandle find(uint64_t id) const;
+    ParticleHandle track(ParticleHandle handle, uint64_t id, int owner);
+    ParticleHandle insert(const TileParticle & particle, int owner);
+    ParticleHandle insert(const TileSpawn & spawn, int owner);
+    void writeState(ParticleHandle handle, const TileParticle & particle);
+    TileParticle readState(size_t index) const;
+    TileSpring describe(const Spring & spring) const;
+    uint64_t colorsOf(ParticleHandle handle) const;
+    bool connected(ParticleHandle a, ParticleHandle b) const;
+    void remove(ParticleHandle handle);
+    bool makeRoom();
+
+    bool exchangeHalo();
+    void connectPending();
+    bool spawnQueued();
+    void evict(size_t excess);
+    void relaxSprings(float dt);
+    bool migrate();
+
+public:
+
+    // `links` has one entry per tile, the one for `tile` itself unused;
+    // the system should be empty and sized for the ghosts too
+    TileSimulation(ParticleSystem & system, const TileLayout & layout, int tile,
+                   std::vector< TileLink > & links);
+    ~TileSimulation();
+
+    bool owns(const ci::Vec2f & position) const { return layout.tileAt(position.x) == tile; };
+
+    // Spawns a particle, which should lie in this tile, at the start of the
+    // next step. Its id names it on every tile and has to be above that of
+    // every particle spawned before it anywhere.
+    void add(uint64_t id, const ParticleSpawn & spawn);
+
+    // One step of the whole simulation; every tile has to call it the same
+    // number of times. False once a link fails.
+    bool step();
+
+    // Particles owned, and the springs of which this tile owns the end
+    // with the lower id, so that the tiles together list each once
+    void collect(std::vector< TileParticle > & particles) const;
+    void collectSprings(std::vector< TileSpring > & springs) const;
+
+    size_t size() const { return ownedCount; };
+    size_t ghostCount() const { return system.particles.size() - ownedCount; };
+
+    // Particles this tile had no room for, spawned or handed to it, and so
+    // lost
+    size_t dropped() const { return droppedCount; };
+
+    // Evicts the particles of the whole simulation over this, lowest ids
+    // first; 0 for no limit. The same on every tile.
+    size_t          maxParticles;
+
+    // The springs of a particle spawned here are drawn from the system
+    // reseeded with seed plus its id
+    uint32_t        seed;
+};
@@ -0,0 +1,93 @@
+#include "TrailStore.h"
+
+#include <algorithm>
+
+
+TrailStore::TrailStore()
+{
+    capacity = 0;
+    length = 0;
+    recorded = 0;
+}
+
+void TrailStore::setSize(size_t capacity, size_t length)
+{
+    if (capacity == this->capacity && length == this->length)
+        return;
+
+    this->capacity = capacity;
+    this->length = length;
+    x.assign(capacity * length, 0.f);
+    y.assign(capacity * length, 0.f);
+    birth.assign(capacity, UINT64_MAX);
+    generation.assign(capacity, 0);
+    recorded = 0;
+}
+
+void TrailStore::clear()
+{
+    std::fill(birth.begin(), birth.end(), UINT64_MAX);
+    recorded = 0;
+}
+
+void TrailStore::record(const ParticleStore & particles)
+{
+    if (! enabled())
+        return;
+
+    size_t row = (size_t)(recorded % length) * capacity;
+    float * rowX = & x[row];
+    float * rowY = & y[row];
+    size_t count = std::min(particles.size(), capacity);
+
+    for (size_t i = 0; i < count; i++){
+        ParticleHandle handle = particles.handleAt(i);
+        uint32_t slot = handle.index;
+        if (birth[slot] == UINT64_MAX || generation[slot] != handle.generation){
+            birth[slot] = recorded;
+            generation[slot] = handle.generation;
+        }
+        rowX[slot] = particles.position[i].x;
+        rowY[slot] = particles.position[i].y;
+    }
+    recorded++;
+}
+
+// The newest sample is the latest step, which the drawn position hasn't
+// reached yet, so each trail starts at the one before
+void TrailStore::build(const ParticleStore & particles, const std::vector< ci::Vec2f > & positions,
+                       const WorldBounds & world, float alpha, std::vector< LineVertex > & vertices) const
+{
+    vertices.clear();
+    if (! enabled() || recorded < 2 || ! (alpha > 0.f))
+        return;
+
+    vertices.reserve(capacity * (length - 1) * 2);
+    size_t count = std::min(positions.size(), capacity);
+    float fade = alpha / (float)(length - 1);
+    bool wraps = world.wraps();
+
+    for (size_t i = 0; i < count; i++){
+        uint32_t slot = particles.handleAt(i).index;
+        if (birth[slot] == UINT64_MAX)
+            continue;
+
+        size_t samples = (size_t)std::min< uint64_t >(recorded - birth[slot], length);
+        ci::ColorA color(particles.color[i], alpha);
+        LineVertex start, end;
+        start.position = positions[i];
+        start.color = color;
+
+        for (size_t age = 1; age < samples; age++){
+            size_t at = (size_t)((recorded - 1 - age) % length) * capacity + slot;
+            color.a = alpha - fade * age;
+            end.position = ci::Vec2f(x[at], y[at]);
+            if (wraps)
+                end.position = start.position + world.delta(start.position, end.position);
+            end.color = color;
+            vertices.push_back(start);
+            vertices.push_back(end);
+            start = end;
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "cinder/Vector.h"
+#include "cinder/Color.h"
+
+#include "ParticleStore.h"
+#include "ConnectionBatch.h"
+#include "WorldBounds.h"
+
+#include <vector>
+#include <cstdint>
+
+// The last `length` positions of every particle, for drawing motion trails.
+//
+// All samples live in one ring allocated up front: `length` rows of one
+// x and one y per handle slot. record() writes a whole row and moves a
+// single head, so a step costs one streaming pass no matter how many
+// particles come and go, and memory stays at capacity x length. Rows are
+// indexed by handle slot, which swap-and-pop removal doesn't move; a slot
+// handed to a new particle starts its trail over.
+class TrailStore {
+
+    size_t                      capacity, length;
+    uint64_t                    recorded;
+
+    // Row r, slot s at [r * capacity + s]
+    std::vector< float >        x, y;
+
+    // Per slot: the row count when its particle's first sample went in,
+    // and the handle generation that particle holds
+    std::vector< uint64_t >     birth;
+    std::vector< uint32_t >     generation;
+
+public:
+
+    TrailStore();
+
+    // Both drop what's recorded; a length of 0 turns trails off
+    void setSize(size_t capacity, size_t length);
+    void setLength(size_t length) { setSize(capacity, length); };
+    void clear();
+
+    // Call after each step
+    void record(const ParticleStore & particles);
+
+    // Lines from each particle's drawn position back through its older
+    // samples, two vertices per line in the particle's color, fading from
+    // `alpha` to nothing; `positions` is where particles are drawn now,
+    // between their previous and latest samples. In a periodic world a
+    // trail follows its particle back out past the edges it came in by.
+    void build(const ParticleStore & particles, const std::vector< ci::Vec2f > & positions,
+               const WorldBounds & world, float alpha, std::vector< LineVertex > & vertices) const;
+
+    size_t getLength() const { return length; };
+    size_t getCapacity() const { return capacity; };
+    bool enabled() const { return length > 1 && capacity > 0; };
+};
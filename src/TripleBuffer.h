@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+
+// Three copies of a T passed from one writer thread to one reader thread
+// without locks. The writer fills its back copy and swaps it with the
+// middle one; the reader swaps the middle one in as its front copy when it
+// holds something newer. Neither side ever waits, and the reader always
+// gets the latest complete copy, skipping any it was too slow for.
+template< typename T >
+class TripleBuffer {
+
+    // Middle index plus FRESH while the reader hasn't taken it yet
+    enum { INDEX = 3, FRESH = 4 };
+
+    T                   buffers[3];
+    std::atomic< int >  middle;
+    int                 back, front;
+
+public:
+
+    TripleBuffer() : middle(1), back(0), front(2) {};
+
+    // Writer side
+    T & writeBuffer() { return buffers[back]; };
+    void publish() { back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX; };
+
+    // Reader side; true when a newer copy was taken
+    bool update()
+    {
+        if (! (middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    };
+    const T & readBuffer() const { return buffers[front]; };
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "cinder/Vector.h"
+#include "cinder/Rect.h"
+
+#include <cmath>
+
+// The rectangle particles live in; an empty one leaves them unbounded.
+//
+// A periodic world wraps around on both axes: a particle leaving one edge
+// comes back in at the opposite one, and the offset between two particles
+// is the one to the nearest image of the other, so particles near opposite
+// edges interact without being copied across. That's only well defined for
+// distances below half the world's width and height.
+struct WorldBounds {
+
+    WorldBounds() : periodic(false) {};
+    WorldBounds(const ci::Rectf & rect, bool periodic) : rect(rect), periodic(periodic) {};
+
+    bool bounded() const { return rect.getWidth() > 0.f && rect.getHeight() > 0.f; };
+    bool wraps() const { return periodic && bounded(); };
+
+    // Whole periods that take what lies `offset` away to its nearest
+    // image; zero when the world doesn't wrap
+    ci::Vec2f imageShift(const ci::Vec2f & offset) const {
+        if (! wraps())
+            return ci::Vec2f::zero();
+        float width = rect.getWidth(), height = rect.getHeight();
+        return ci::Vec2f(-width * std::floor(offset.x / width + .5f),
+                         -height * std::floor(offset.y / height + .5f));
+    };
+
+    // The offset to that nearest image
+    ci::Vec2f shortest(const ci::Vec2f & offset) const {
+        return wraps() ? offset + imageShift(offset) : offset;
+    };
+    ci::Vec2f delta(const ci::Vec2f & from, const ci::Vec2f & to) const { return shortest(to - from); };
+
+    // The image of `position` inside the rectangle, however far out it was
+    ci::Vec2f wrap(ci::Vec2f position) const {
+        float width = rect.getWidth(), height = rect.getHeight();
+        position.x -= width * std::floor((position.x - rect.x1) / width);
+        position.y -= height * std::floor((position.y - rect.y1) / height);
+        return position;
+    };
+
+    ci::Rectf   rect;
+    bool        periodic;
+};
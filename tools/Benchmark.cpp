@@ -0,0 +1,361 @@
+// Times each simulation phase on its own at several particle counts and
+// spring densities, from fixed seeds, and prints one machine-readable row
+// per (phase, particles, springs per particle).
+//
+//   Benchmark [--sizes 100,1000,10000,100000] [--springs 0,2,8]
+//             [--min-time <seconds>] [--serial] [--json]
+//   Benchmark --verify
+//
+// Phases:
+//   update     ParticleSystem::updateParticles(): grid, borders, flocking
+//   springs    ParticleSystem::updateSprings()
+//   add        ParticleSystem::addParticle(), including spring creation
+//   destroy    ParticleSystem::destroyParticle(), random order
+//   lines      ConnectionBatch::build(), the connection-line pass
+//
+// Columns: ns per particle, particles processed per second, bytes allocated
+// per iteration, and bytes held by the heap once the phase is done. The
+// springs column is the spring count the phase left behind.
+//
+// --verify instead checks the SIMD kernels at every level the CPU supports
+// against the scalar ones and the sprite batch's packing against the
+// particles it packed, prints one line per check, and exits with 1 if any
+// of them fails.
+
+#include "cinder/Rand.h"
+
+#include "ParticleSystem.h"
+#include "ConnectionBatch.h"
+#include "SpriteBatch.h"
+#include "SimdKernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+// Heap accounting through the global allocation functions
+
+static std::atomic< size_t > allocatedBytes(0);
+static std::atomic< size_t > liveBytes(0);
+
+#define ALLOCATION_HEADER   16
+
+void * operator new(size_t size)
+{
+    char * block = (char *)malloc(size + ALLOCATION_HEADER);
+    if (block == NULL)
+        throw std::bad_alloc();
+    *(size_t *)block = size;
+    allocatedBytes += size;
+    liveBytes += size;
+    return block + ALLOCATION_HEADER;
+}
+
+void operator delete(void * pointer) noexcept
+{
+    if (pointer == NULL)
+        return;
+    char * block = (char *)pointer - ALLOCATION_HEADER;
+    liveBytes -= *(size_t *)block;
+    free(block);
+}
+
+void * operator new[](size_t size) { return operator new(size); }
+void operator delete[](void * pointer) noexcept { operator delete(pointer); }
+void operator delete(void * pointer, size_t) noexcept { operator delete(pointer); }
+void operator delete[](void * pointer, size_t) noexcept { operator delete(pointer); }
+
+// Benchmark cases
+
+// Constant density, so the neighbor and line counts per particle don't
+// change with the particle count
+#define AREA_PER_PARTICLE   1600.f
+#define SEED                20131015
+
+struct Options {
+
+    Options() : minTime(.25), parallel(true), json(false) {};
+
+    std::vector< int >  sizes;
+    std::vector< int >  springDensities;
+    double              minTime;
+    bool                parallel;
+    bool                json;
+};
+
+struct Result {
+
+    const char *    phase;
+    int             particles;
+    int             springsPerParticle;
+    size_t          springs;
+    int             iterations;
+    double          seconds;
+    size_t          allocated;
+    size_t          live;
+};
+
+static ci::Rectf worldFor(int particles)
+{
+    float side = ci::math<float>::sqrt(particles * AREA_PER_PARTICLE);
+    return ci::Rectf(0.f, 0.f, side, side);
+}
+
+static void configure(ParticleSystem & system, int particles, int springsPerParticle, const Options & options)
+{
+    system.setCapacity(particles, (size_t)particles * ci::math<int>::max(springsPerParticle, 1));
+    system.maxParticles = particles;
+    system.springsPerParticle = springsPerParticle;
+    system.parallelStep = options.parallel;
+    system.setBorders(worldFor(particles));
+}
+
+static void populate(ParticleSystem & system, int particles)
+{
+    ci::Rectf world = system.getBorders();
+    ci::Color palette[3] = { ci::Color(1.f, .4f, .2f), ci::Color(.2f, .6f, 1.f), ci::Color::white() };
+
+    for (int i = 0; i < particles; i++){
+        ci::Vec2f position(ci::randFloat(world.x1, world.x2), ci::randFloat(world.y1, world.y2));
+        float radius = ci::randFloat(.8f, 1.6f);
+        ParticleHandle handle = system.addParticle(position, radius, radius * radius, .95f,
+                                                   20.f, 50.f, palette[i % 3]);
+        system.particles.velocity[system.particles.indexOf(handle)] = ci::randVec2f();
+    }
+    system.setFlocking(true, 1.2f, .9f, .4f);
+}
+
+static double now()
+{
+    return std::chrono::duration< double >(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Runs `phase` on a fresh copy of the scene from `setup` until it has
+// taken at least minTime; the setup isn't timed.
+template< typename Setup, typename Phase >
+static Result measure(const char * name, int particles, int springsPerParticle,
+                      const Options & options, Setup setup, Phase phase, bool setupEachIteration)
+{
+    Result result;
+    result.phase = name;
+    result.particles = particles;
+    result.springsPerParticle = springsPerParticle;
+    result.iterations = 0;
+    result.seconds = 0.0;
+    result.allocated = 0;
+
+    ParticleSystem system;
+    ConnectionBatch connections;
+    connections.setCapacity((size_t)particles * 32);
+
+    ci::randSeed(SEED + particles);
+    setup(system);
+
+    while (result.iterations < 3 || result.seconds < options.minTime){
+        if (setupEachIteration && result.iterations > 0){
+            ci::randSeed(SEED + particles);
+            setup(system);
+        }
+
+        size_t allocatedBefore = allocatedBytes;
+        double start = now();
+        phase(system, connections);
+        result.seconds += now() - start;
+        result.allocated += allocatedBytes - allocatedBefore;
+        result.iterations++;
+    }
+    result.springs = system.springs.size();
+    result.live = liveBytes;
+    return result;
+}
+
+static void runCase(int particles, int springsPerParticle, const Options & options, std::vector< Result > & results)
+{
+    auto empty = [&](ParticleSystem & system){
+        system.clear();
+        configure(system, particles, springsPerParticle, options);
+    };
+    auto populated = [&](ParticleSystem & system){
+        empty(system);
+        populate(system, particles);
+    };
+
+    results.push_back(measure("update", particles, springsPerParticle, options, populated,
+                              [](ParticleSystem & system, ConnectionBatch &){ system.updateParticles(); }, false));
+
+    results.push_back(measure("springs", particles, springsPerParticle, options, populated,
+                              [](ParticleSystem & system, ConnectionBatch &){ system.updateSprings(); }, false));
+
+    results.push_back(measure("add", particles, springsPerParticle, options, empty,
+                              [&](ParticleSystem & system, ConnectionBatch &){ populate(system, particles); }, true));
+
+    results.push_back(measure("destroy", particles, springsPerParticle, options, populated,
+                              [](ParticleSystem & system, ConnectionBatch &){
+                                  ParticleStore & store = system.particles;
+                                  while (! store.empty())
+                                      system.destroyParticle(store.handleAt(ci::randInt((int)store.size())));
+                              }, true));
+
+    results.push_back(measure("lines", particles, springsPerParticle, options, populated,
+                              [](ParticleSystem & system, ConnectionBatch & connections){
+                                  connections.build(system.particles, 100.f);
+                              }, false));
+}
+
+static void printResult(const Result & result, const Options & options)
+{
+    double perIteration = result.seconds / result.iterations;
+    double nsPerParticle = perIteration * 1e9 / result.particles;
+    double perSecond = result.particles / perIteration;
+    size_t allocatedPerIteration = result.allocated / result.iterations;
+
+    if (options.json)
+        printf("{\"phase\":\"%s\",\"particles\":%d,\"springs_per_particle\":%d,\"springs\":%zu,"
+               "\"iterations\":%d,\"ns_per_particle\":%.2f,\"particles_per_second\":%.0f,"
+               "\"allocated_bytes\":%zu,\"live_bytes\":%zu}\n",
+               result.phase, result.particles, result.springsPerParticle, result.springs,
+               result.iterations, nsPerParticle, perSecond, allocatedPerIteration, result.live);
+    else
+        printf("%s,%d,%d,%zu,%d,%.2f,%.0f,%zu,%zu\n",
+               result.phase, result.particles, result.springsPerParticle, result.springs,
+               result.iterations, nsPerParticle, perSecond, allocatedPerIteration, result.live);
+    fflush(stdout);
+}
+
+// Whether the six vertices at `first` are two triangles of one quad around
+// `center`, mapping `texCoords` in `color`
+static bool isSprite(const SpriteVertex * first, const ci::Vec2f & center,
+                     const ci::Rectf & texCoords, const ci::ColorA & color)
+{
+    static const int CORNERS[6] = { 0, 1, 2, 0, 2, 3 };
+    const SpriteVertex & topLeft = first[0];
+    const SpriteVertex & bottomRight = first[2];
+    float halfSize = (bottomRight.position.x - topLeft.position.x) * .5f;
+    if (halfSize <= 0.f || ((topLeft.position + bottomRight.position) * .5f).distance(center) > 1e-3f)
+        return false;
+
+    for (int v = 0; v < 6; v++){
+        int corner = CORNERS[v];
+        bool right = corner == 1 || corner == 2;
+        bool bottom = corner >= 2;
+        ci::Vec2f position = center + ci::Vec2f(right ? halfSize : -halfSize, bottom ? halfSize : -halfSize);
+        ci::Vec2f texCoord(right ? texCoords.x2 : texCoords.x1, bottom ? texCoords.y2 : texCoords.y1);
+        const ci::ColorA & vertexColor = first[v].color;
+        if (first[v].position.distance(position) > 1e-3f || first[v].texCoord != texCoord ||
+            vertexColor.r != color.r || vertexColor.g != color.g || vertexColor.b != color.b ||
+            vertexColor.a != color.a)
+            return false;
+    }
+    return true;
+}
+
+// Packs a few particles' discs and halos, then again past a small capacity
+static bool verifySprites()
+{
+    ci::Rand random(5);
+    std::vector< ci::Vec2f > positions;
+    std::vector< ci::Color > colors;
+    std::vector< float > radii;
+    for (int i = 0; i < 100; i++){
+        positions.push_back(ci::Vec2f(random.nextFloat(-500.f, 500.f), random.nextFloat(-500.f, 500.f)));
+        colors.push_back(ci::Color(random.nextFloat(), random.nextFloat(), random.nextFloat()));
+        radii.push_back(random.nextFloat(1.f, 10.f));
+    }
+
+    SpriteBatch sprites;
+    sprites.pack(positions, colors, radii);
+    if (sprites.spriteCount() != positions.size() * 2 || sprites.vertexCount() != sprites.spriteCount() * 6)
+        return false;
+    for (size_t i = 0; i < positions.size(); i++){
+        const SpriteVertex * disc = sprites.data() + i * 12;
+        if (! isSprite(disc, positions[i], SpriteBatch::DISC_COORDS, ci::ColorA(colors[i], 1.f)) ||
+            ! isSprite(disc + 6, positions[i], SpriteBatch::HALO_COORDS, ci::ColorA(colors[i], .7f)))
+            return false;
+        // The ring's middle sits just outside the disc's radius
+        float haloHalfSize = disc[8].position.x - positions[i].x;
+        if (ci::math<float>::abs(haloHalfSize * SpriteBatch::RING_RADIUS - radii[i] * 1.2f) > 1e-3f)
+            return false;
+    }
+
+    sprites.setCapacity(51);
+    sprites.pack(positions, colors, radii);
+    return sprites.full() && sprites.spriteCount() == 51 &&
+           isSprite(sprites.data() + 50 * 6, positions[25], SpriteBatch::DISC_COORDS, ci::ColorA(colors[25], 1.f));
+}
+
+static int verifyKernels()
+{
+    bool passed = true;
+    for (int level = SIMD_SCALAR; level <= detectSimdLevel(); level++){
+        bool same = verifySimdKernels((SimdLevel)level);
+        printf("%s,%s\n", simdLevelName((SimdLevel)level), same ? "ok" : "mismatch");
+        passed = passed && same;
+    }
+    bool packed = verifySprites();
+    printf("Sprites,%s\n", packed ? "ok" : "mismatch");
+    return passed && packed ? 0 : 1;
+}
+
+static bool parseList(const char * text, std::vector< int > & values)
+{
+    values.clear();
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')){
+        int value = atoi(item.c_str());
+        if (value < 0 || item.empty())
+            return false;
+        values.push_back(value);
+    }
+    return ! values.empty();
+}
+
+int main(int argc, char * argv[])
+{
+    Options options;
+    options.sizes = { 100, 1000, 10000, 100000 };
+    options.springDensities = { 0, 2, 8 };
+
+    for (int i = 1; i < argc; i++){
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--sizes") == 0 && hasValue && parseList(argv[i + 1], options.sizes))
+            i++;
+        else if (strcmp(argv[i], "--springs") == 0 && hasValue && parseList(argv[i + 1], options.springDensities))
+            i++;
+        else if (strcmp(argv[i], "--min-time") == 0 && hasValue)
+            options.minTime = atof(argv[++i]);
+        else if (strcmp(argv[i], "--serial") == 0)
+            options.parallel = false;
+        else if (strcmp(argv[i], "--json") == 0)
+            options.json = true;
+        else if (strcmp(argv[i], "--verify") == 0)
+            return verifyKernels();
+        else {
+            fprintf(stderr, "usage: %s [--sizes 100,1000,...] [--springs 0,2,8] "
+                            "[--min-time seconds] [--serial] [--json] | --verify\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (! options.json)
+        printf("phase,particles,springs_per_particle,springs,iterations,"
+               "ns_per_particle,particles_per_second,allocated_bytes,live_bytes\n");
+
+    for (int particles : options.sizes){
+        for (int springsPerParticle : options.springDensities){
+            std::vector< Result > results;
+            runCase(particles, springsPerParticle, options, results);
+            for (auto & result : results)
+                printResult(result, options);
+        }
+    }
+    return 0;
+}
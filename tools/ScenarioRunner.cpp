@@ -0,0 +1,272 @@
+// Replays a scripted emission scenario against the simulation core without
+// a window, as fast as possible, and reports how many steps per second it
+// managed.
+//
+//   ScenarioRunner [--serial] [--lines] [--profile <csv file>]
+//                  [--export <frame file>] <scenario file>
+//
+// A scenario is a list of commands, one per line, run top to bottom; see
+// tools/scenarios/ for examples. '#' starts a comment.
+//
+//   bounds <x1> <y1> <x2> <y2>     world borders, empty for unbounded
+//   periodic <on>                  wrap around the borders instead of bouncing
+//   seed <n>                       random seed for emission
+//   capacity <particles> <springs> preallocated pool sizes
+//   maxParticles <n>
+//   springs <perParticle> <radius> [iterations]
+//   flocking <on> <separation> <alignment> <cohesion> [steering cohesion]
+//   distances <targetSeparation> <neighboringDistance>
+//   radius <min> <max>
+//   color <r> <g> <b>
+//   attractor <on> <x> <y>
+//   field <on> <strength> <scale> [speed]   curl noise force field
+//   trails <length>                samples per particle trail, 0 for none
+//   emit <steps> <perStep> <x> <y> <spread>
+//   run <steps>
+//   clear
+
+#include "cinder/Rand.h"
+
+#include "ParticleSystem.h"
+#include "ConnectionBatch.h"
+#include "FrameExporter.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+
+struct Scenario {
+
+    Scenario() :
+        exportPath(NULL),
+        flocking(false), cohesionSteers(false),
+        separationFactor(1.f), alignmentFactor(1.f), cohesionFactor(1.f),
+        targetSeparation(20.f), neighboringDistance(50.f),
+        radiusMin(.8f), radiusMax(1.6f), color(ci::Color::white()),
+        drawLines(false), steps(0), lines(0), seconds(0.0) {};
+
+    ParticleSystem  system;
+    ConnectionBatch connections;
+    std::vector< LineVertex > trailVertices;
+    Profiler        profiler;
+    FrameExporter   exporter;
+    const char *    exportPath;
+
+    bool        flocking, cohesionSteers;
+    float       separationFactor, alignmentFactor, cohesionFactor;
+    float       targetSeparation, neighboringDistance;
+    float       radiusMin, radiusMax;
+    ci::Color   color;
+
+    bool        drawLines;
+    size_t      steps;
+    size_t      lines;
+    double      seconds;
+
+    void step();
+    void emit(const ci::Vec2f & center, float spread, int count);
+};
+
+// Times the same work ClimaxApp::update() does per frame; emission is done
+// beforehand, as input events are in the app.
+void Scenario::step()
+{
+    // Sized once the scenario has set its capacity
+    if (exportPath && ! exporter.isRunning() && ! exporter.start(exportPath, system.particles.capacity())){
+        fprintf(stderr, "could not open %s\n", exportPath);
+        exportPath = NULL;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    FlockingRules rules;
+    rules.separationEnabled = rules.alignmentEnabled = rules.cohesionEnabled = flocking;
+    rules.cohesionSteers = cohesionSteers;
+    rules.separationFactor = separationFactor;
+    rules.alignmentFactor = alignmentFactor;
+    rules.cohesionFactor = cohesionFactor;
+    system.setFlocking(rules);
+    system.update();
+    if (drawLines && system.trails.enabled()){
+        ProfileTimer timer(system.profiler, PROFILE_TRAILS);
+        system.trails.build(system.particles, system.particles.position, system.getWorld(), 1.f, trailVertices);
+    }
+    if (drawLines){
+        ProfileTimer timer(system.profiler, PROFILE_LINES);
+        connections.build(system.particles, 100.f, system.getWorld());
+        lines += connections.lineCount();
+        profiler.count(PROFILE_LINE_PAIRS, connections.pairCount());
+    }
+
+    exporter.publish(steps, system.particles);
+
+    seconds += std::chrono::duration< double >(std::chrono::steady_clock::now() - start).count();
+    steps++;
+    if (system.profiler)
+        profiler.endFrame();
+}
+
+// Same spawn attributes as ClimaxApp::makeParticleSpawn()
+void Scenario::emit(const ci::Vec2f & center, float spread, int count)
+{
+    for (int i = 0; i < count; i++){
+        ci::Vec2f position = center + ci::Vec2f(ci::randFloat(-spread, spread), ci::randFloat(-spread, spread));
+        float radius = ci::randFloat(radiusMin, radiusMax);
+        system.addParticle(position, radius, radius * radius, .95f,
+                           targetSeparation, neighboringDistance, color);
+    }
+}
+
+static bool runCommand(Scenario & scenario, const std::string & command, std::istringstream & args)
+{
+    ParticleSystem & system = scenario.system;
+
+    if (command == "bounds"){
+        float x1, y1, x2, y2;
+        if (! (args >> x1 >> y1 >> x2 >> y2)) return false;
+        system.setBorders(ci::Rectf(x1, y1, x2, y2));
+    }
+    else if (command == "periodic"){
+        bool periodic;
+        if (! (args >> periodic)) return false;
+        system.setPeriodic(periodic);
+    }
+    else if (command == "seed"){
+        int seed;
+        if (! (args >> seed)) return false;
+        ci::randSeed(seed);
+    }
+    else if (command == "capacity"){
+        size_t particleCapacity, springCapacity;
+        if (! (args >> particleCapacity >> springCapacity)) return false;
+        system.setCapacity(particleCapacity, springCapacity);
+    }
+    else if (command == "trails"){
+        size_t length;
+        if (! (args >> length)) return false;
+        system.trails.setLength(length);
+    }
+    else if (command == "maxParticles"){
+        if (! (args >> system.maxParticles)) return false;
+    }
+    else if (command == "springs"){
+        if (! (args >> system.springsPerParticle >> system.springRadius)) return false;
+        int iterations;
+        if (args >> iterations) system.springIterations = iterations;
+    }
+    else if (command == "flocking"){
+        if (! (args >> scenario.flocking >> scenario.separationFactor
+                    >> scenario.alignmentFactor >> scenario.cohesionFactor)) return false;
+        bool steers;
+        scenario.cohesionSteers = (args >> steers) && steers;
+    }
+    else if (command == "distances"){
+        if (! (args >> scenario.targetSeparation >> scenario.neighboringDistance)) return false;
+    }
+    else if (command == "radius"){
+        if (! (args >> scenario.radiusMin >> scenario.radiusMax)) return false;
+    }
+    else if (command == "color"){
+        if (! (args >> scenario.color.r >> scenario.color.g >> scenario.color.b)) return false;
+    }
+    else if (command == "attractor"){
+        if (! (args >> system.attractor.enabled >> system.attractor.center.x
+                    >> system.attractor.center.y)) return false;
+    }
+    else if (command == "field"){
+        ForceField & field = system.forceField;
+        if (! (args >> field.enabled >> field.noiseStrength >> field.noiseScale)) return false;
+        float speed;
+        if (args >> speed) field.noiseSpeed = speed;
+        field.invalidate();
+    }
+    else if (command == "emit"){
+        int steps, perStep;
+        float x, y, spread;
+        if (! (args >> steps >> perStep >> x >> y >> spread)) return false;
+        for (int i = 0; i < steps; i++){
+            scenario.emit(ci::Vec2f(x, y), spread, perStep);
+            scenario.step();
+        }
+    }
+    else if (command == "run"){
+        int steps;
+        if (! (args >> steps)) return false;
+        for (int i = 0; i < steps; i++)
+            scenario.step();
+    }
+    else if (command == "clear"){
+        system.clear();
+    }
+    else return false;
+
+    return true;
+}
+
+int main(int argc, char * argv[])
+{
+    Scenario scenario;
+    const char * path = NULL;
+
+    // Parallel like the app unless asked otherwise
+    scenario.system.parallelStep = true;
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--serial") == 0)
+            scenario.system.parallelStep = false;
+        else if (strcmp(argv[i], "--lines") == 0)
+            scenario.drawLines = true;
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc){
+            if (! scenario.profiler.openCsv(argv[++i])){
+                fprintf(stderr, "could not open %s\n", argv[i]);
+                return 1;
+            }
+            scenario.system.profiler = & scenario.profiler;
+        }
+        else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+            scenario.exportPath = argv[++i];
+        else
+            path = argv[i];
+    }
+    if (path == NULL){
+        fprintf(stderr, "usage: %s [--serial] [--lines] [--profile csv] [--export file] <scenario file>\n", argv[0]);
+        return 2;
+    }
+    std::ifstream file(path);
+    if (! file){
+        fprintf(stderr, "could not open %s\n", path);
+        return 1;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)){
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream args(line);
+        std::string command;
+        if (! (args >> command))
+            continue;
+        if (! runCommand(scenario, command, args)){
+            fprintf(stderr, "%s:%d: bad command: %s\n", path, lineNumber, line.c_str());
+            return 1;
+        }
+    }
+
+    double stepsPerSecond = scenario.seconds > 0.0 ? scenario.steps / scenario.seconds : 0.0;
+    printf("scenario=%s steps=%zu particles=%zu springs=%zu",
+           path, scenario.steps, scenario.system.particles.size(), scenario.system.springs.size());
+    if (scenario.drawLines)
+        printf(" lines/step=%.1f", scenario.steps > 0 ? (double)scenario.lines / scenario.steps : 0.0);
+    if (scenario.exporter.isRunning()){
+        scenario.exporter.stop();
+        printf(" exported=%llu dropped=%llu", (unsigned long long)scenario.exporter.framesWritten(),
+               (unsigned long long)scenario.exporter.framesDropped());
+    }
+    printf(" seconds=%.3f steps/s=%.1f\n", scenario.seconds, stepsPerSecond);
+    return 0;
+}
@@ -0,0 +1,459 @@
+// Runs one emission scenario in a single process and split into tiles over
+// local processes, then reports how far apart the two ended up and how
+// fast each ran.
+//
+//   TileHarness [--tiles <n>] [--steps <n>] [--particles <n>]
+//               [--springs <perParticle>] [--scaling]
+//
+// Every tile is a forked process joined to every other one by a Unix
+// socketpair. Particles are numbered in emission order, and each spawn
+// reseeds the system from its number, so both runs draw the same spring
+// lengths and strengths. Emission goes on past --particles, so the oldest
+// get evicted. At a few checkpoints the tiles send the parent the
+// particles they own; every particle of the single run has to be owned by
+// exactly one tile, none may have been dropped by a tile too full to take
+// it over, and the report gives the largest and mean distance between the
+// two copies and the springs either run has that the other hasn't. With
+// --scaling the tiled run is timed alone at 1, 2, 4... tiles up to
+// --tiles.
+
+#include "cinder/Rand.h"
+
+#include "ParticleSystem.h"
+#include "TileSimulation.h"
+#include "TileLink.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+#define SEED            20131015
+// Emission reaches --particles after FILL_STEPS and goes on to EMIT_STEPS
+#define FILL_STEPS      100
+#define EMIT_STEPS      150
+
+// The widest interaction radius of the spawns below and the spring radius
+#define SPRING_RADIUS   60.f
+#define HALO_WIDTH      60.f
+
+// Tiles compute what one process does in the same order (see
+// TileSimulation), so every checkpoint has to match within EXACT_ERROR
+// pixels and spring for spring. The flocking steers chaotically, so any
+// rounding difference grows far past this within a few hundred steps.
+#define EXACT_ERROR     1e-3f
+
+struct Options {
+
+    Options() : tiles(4), steps(300), particles(4000), springs(2), scaling(false) {};
+
+    int     tiles;
+    int     steps;
+    int     particles;
+    int     springs;
+    bool    scaling;
+};
+
+struct Emission {
+    int             step;
+    uint64_t        id;
+    ParticleSpawn   spawn;
+};
+
+// What a run looks like at a checkpoint
+struct Checkpoint {
+
+    Checkpoint() : step(0), duplicates(0), dropped(0) {};
+
+    int                             step;
+    std::map< uint64_t, ci::Vec2f > positions;
+    std::set< std::pair< uint64_t, uint64_t > > springs;
+    size_t                          duplicates;
+    size_t                          dropped;
+};
+
+struct RunResult {
+
+    RunResult() : seconds(0.0), ghosts(0) {};
+
+    std::vector< Checkpoint >   checkpoints;
+    double                      seconds;
+    size_t                      ghosts;
+};
+
+static const ci::Rectf borders(0.f, 0.f, 1920.f, 1080.f);
+
+// Same world as the paint scenario, pulled towards the middle so plenty
+// of particles cross tile edges
+static void configure(ParticleSystem & system, const Options & options, size_t workerThreads)
+{
+    // Room for a step's spawns over maxParticles and a tile's ghosts, so
+    // neither run drops a particle or a spring for want of a slot
+    system.setCapacity(options.particles * 2 + 16, options.particles * ci::math<int>::max(options.springs, 1) * 4 + 16);
+    system.setBorders(borders);
+    system.maxParticles = options.particles;
+    system.springsPerParticle = options.springs;
+    system.springRadius = SPRING_RADIUS;
+    system.setFlocking(true, 1.5f, 1.f, .4f);
+    system.attractor.enabled = true;
+    system.attractor.center = borders.getCenter();
+    system.parallelStep = true;
+    system.canonicalOrder = true;
+    system.workerThreads = workerThreads;
+}
+
+static std::vector< Emission > makeEmissions(const Options & options)
+{
+    std::vector< Emission > emissions;
+    ci::Rand random(SEED);
+    int perStep = ci::math<int>::max(options.particles / FILL_STEPS, 1);
+    uint64_t id = 0;
+
+    for (int step = 0; step < EMIT_STEPS; step++){
+        for (int i = 0; i < perStep; i++){
+            Emission emission;
+            emission.step = step;
+            emission.id = id++;
+            float radius = random.nextFloat(.8f, 1.6f);
+            ci::Color color = random.nextFloat() < .5f ? ci::Color(1.f, .4f, .2f) : ci::Color(.2f, .6f, 1.f);
+            emission.spawn = ParticleSpawn(ci::Vec2f(random.nextFloat(borders.x1, borders.x2),
+                                                     random.nextFloat(borders.y1, borders.y2)),
+                                           radius, radius * radius, .95f, 20.f, 50.f, color);
+            emissions.push_back(emission);
+        }
+    }
+    return emissions;
+}
+
+static std::vector< int > checkpointSteps(const Options & options)
+{
+    std::vector< int > steps;
+    int candidates[] = { 1, 10, 100, options.steps };
+    for (int step : candidates)
+        if (step <= options.steps && (steps.empty() || step > steps.back()))
+            steps.push_back(step);
+    return steps;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration< double >(std::chrono::steady_clock::now() - start).count();
+}
+
+static RunResult runSingle(const Options & options, const std::vector< Emission > & emissions)
+{
+    ParticleSystem system;
+    configure(system, options, 0);
+
+    RunResult result;
+    std::vector< uint64_t > slotId(system.particles.capacity());
+    std::vector< int > checkpoints = checkpointSteps(options);
+    size_t next = 0;
+
+    for (int step = 1; step <= options.steps; step++){
+        auto start = std::chrono::steady_clock::now();
+        for (; next < emissions.size() && emissions[next].step == step - 1; next++){
+            const Emission & emission = emissions[next];
+            const ParticleSpawn & spawn = emission.spawn;
+            system.reseed((uint32_t)(SEED + emission.id));
+            ParticleHandle handle = system.addParticle(spawn.position, spawn.radius, spawn.mass, spawn.drag,
+                                                       spawn.targetSeparation, spawn.neighboringDistance,
+                                                       spawn.color);
+            slotId[handle.index] = emission.id;
+        }
+        system.update();
+        result.seconds += secondsSince(start);
+
+        if (std::find(checkpoints.begin(), checkpoints.end(), step) == checkpoints.end())
+            continue;
+        Checkpoint checkpoint;
+        checkpoint.step = step;
+        for (size_t i = 0; i < system.particles.size(); i++)
+            checkpoint.positions[slotId[system.particles.handleAt(i).index]] = system.particles.position[i];
+        for (auto & spring : system.springs){
+            uint64_t a = slotId[spring.particleA.index], b = slotId[spring.particleB.index];
+            checkpoint.springs.insert(std::make_pair(std::min(a, b), std::max(a, b)));
+        }
+        result.checkpoints.push_back(checkpoint);
+    }
+    return result;
+}
+
+// Runs in the forked process of one tile; reports to the parent over
+// `parent` at each checkpoint
+static void runTile(const Options & options, const std::vector< Emission > & emissions,
+                    int tiles, int tile, std::vector< TileLink > & links, TileLink & parent)
+{
+    size_t cores = std::max< size_t >(std::thread::hardware_concurrency(), 1);
+    ParticleSystem system;
+    configure(system, options, std::max< size_t >(cores / tiles, 1));
+    TileSimulation simulation(system, TileLayout(borders, tiles, HALO_WIDTH), tile, links);
+    simulation.seed = SEED;
+    simulation.maxParticles = options.particles;
+
+    std::vector< TileLink > report(1);
+    report[0] = parent;
+    std::vector< int > checkpoints = checkpointSteps(options);
+    std::vector< TileParticle > particles;
+    std::vector< TileSpring > springs;
+    size_t next = 0;
+    double seconds = 0.0;
+
+    for (int step = 1; step <= options.steps; step++){
+        auto start = std::chrono::steady_clock::now();
+        for (; next < emissions.size() && emissions[next].step == step - 1; next++){
+            const Emission & emission = emissions[next];
+            if (! simulation.owns(emission.spawn.position))
+                continue;
+            simulation.add(emission.id, emission.spawn);
+        }
+        if (! simulation.step()){
+            fprintf(stderr, "tile %d: lost a link at step %d\n", tile, step);
+            _exit(1);
+        }
+        seconds += secondsSince(start);
+
+        if (std::find(checkpoints.begin(), checkpoints.end(), step) == checkpoints.end())
+            continue;
+        simulation.collect(particles);
+        simulation.collectSprings(springs);
+        uint64_t ghosts = simulation.ghostCount();
+        uint64_t dropped = simulation.dropped();
+        report[0].write(particles);
+        report[0].write(springs);
+        report[0].write(seconds);
+        report[0].write(ghosts);
+        report[0].write(dropped);
+        if (! TileLink::exchange(report))
+            _exit(1);
+    }
+    _exit(0);
+}
+
+static bool runTiled(const Options & options, const std::vector< Emission > & emissions,
+                     int tiles, RunResult & result)
+{
+    // peers[i][j] is tile i's end of the socket to tile j
+    std::vector< std::vector< int > > peers(tiles, std::vector< int >(tiles, -1));
+    std::vector< int > parentEnds(tiles), childEnds(tiles);
+    for (int i = 0; i < tiles; i++){
+        for (int j = i + 1; j < tiles; j++){
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+                return false;
+            peers[i][j] = pair[0];
+            peers[j][i] = pair[1];
+        }
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+            return false;
+        parentEnds[i] = pair[0];
+        childEnds[i] = pair[1];
+    }
+
+    std::vector< pid_t > children;
+    for (int tile = 0; tile < tiles; tile++){
+        pid_t pid = fork();
+        if (pid < 0)
+            return false;
+        if (pid > 0){
+            children.push_back(pid);
+            continue;
+        }
+
+        // Keep only this tile's ends
+        std::vector< TileLink > links(tiles);
+        for (int i = 0; i < tiles; i++){
+            close(parentEnds[i]);
+            if (i != tile)
+                close(childEnds[i]);
+            for (int j = 0; j < tiles; j++){
+                if (peers[i][j] < 0)
+                    continue;
+                if (i == tile)
+                    links[j] = TileLink(peers[i][j]);
+                else
+                    close(peers[i][j]);
+            }
+        }
+        TileLink parent(childEnds[tile]);
+        runTile(options, emissions, tiles, tile, links, parent);
+    }
+
+    std::vector< TileLink > links;
+    for (int i = 0; i < tiles; i++){
+        close(childEnds[i]);
+        for (int j = 0; j < tiles; j++)
+            if (peers[i][j] >= 0)
+                close(peers[i][j]);
+        links.push_back(TileLink(parentEnds[i]));
+    }
+
+    bool ok = true;
+    std::vector< TileParticle > particles;
+    std::vector< TileSpring > springs;
+    for (int step : checkpointSteps(options)){
+        if (! TileLink::exchange(links)){
+            ok = false;
+            break;
+        }
+        Checkpoint checkpoint;
+        checkpoint.step = step;
+        result.seconds = 0.0;
+        result.ghosts = 0;
+        for (auto & link : links){
+            TileReader reader(link.inbox());
+            double seconds = 0.0;
+            uint64_t ghosts = 0, dropped = 0;
+            reader.read(particles);
+            reader.read(springs);
+            reader.read(seconds);
+            reader.read(ghosts);
+            reader.read(dropped);
+            if (! reader.ok())
+                ok = false;
+
+            // Tiles step in lockstep, so the slowest one sets the pace
+            result.seconds = std::max(result.seconds, seconds);
+            result.ghosts += ghosts;
+            checkpoint.dropped += dropped;
+            for (auto & particle : particles)
+                if (! checkpoint.positions.insert(std::make_pair(particle.id, particle.position)).second)
+                    checkpoint.duplicates++;
+            for (auto & spring : springs)
+                checkpoint.springs.insert(std::make_pair(std::min(spring.a, spring.b), std::max(spring.a, spring.b)));
+        }
+        result.checkpoints.push_back(checkpoint);
+    }
+
+    for (auto & link : links)
+        link.close();
+    for (auto pid : children){
+        int status = 0;
+        waitpid(pid, & status, 0);
+        if (! WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            ok = false;
+    }
+    return ok;
+}
+
+// Prints one row per checkpoint; false if a particle went missing, was
+// owned twice or was dropped, or the tiled run strayed at all
+static bool compare(const RunResult & single, const RunResult & tiled)
+{
+    bool consistent = true;
+    for (size_t c = 0; c < single.checkpoints.size() && c < tiled.checkpoints.size(); c++){
+        const Checkpoint & expected = single.checkpoints[c];
+        const Checkpoint & actual = tiled.checkpoints[c];
+
+        size_t missing = 0;
+        float maxError = 0.f;
+        double totalError = 0.0;
+        for (auto & entry : expected.positions){
+            auto found = actual.positions.find(entry.first);
+            if (found == actual.positions.end()){
+                missing++;
+                continue;
+            }
+            float error = entry.second.distance(found->second);
+            maxError = std::max(maxError, error);
+            totalError += error;
+        }
+        size_t extra = 0;
+        for (auto & entry : actual.positions)
+            if (expected.positions.find(entry.first) == expected.positions.end())
+                extra++;
+        size_t springsMissing = 0, springsExtra = 0;
+        for (auto & spring : expected.springs)
+            if (actual.springs.find(spring) == actual.springs.end())
+                springsMissing++;
+        for (auto & spring : actual.springs)
+            if (expected.springs.find(spring) == expected.springs.end())
+                springsExtra++;
+
+        size_t matched = expected.positions.size() - missing;
+        double meanError = matched ? totalError / matched : 0.0;
+        printf("step=%d particles=%zu/%zu missing=%zu extra=%zu duplicated=%zu dropped=%zu "
+               "maxError=%.6f meanError=%.6f springs=%zu/%zu springsMissing=%zu springsExtra=%zu\n",
+               expected.step, actual.positions.size(), expected.positions.size(), missing, extra,
+               actual.duplicates, actual.dropped, maxError, meanError,
+               actual.springs.size(), expected.springs.size(), springsMissing, springsExtra);
+        if (missing || extra || actual.duplicates || actual.dropped)
+            consistent = false;
+
+        if (maxError > EXACT_ERROR || springsMissing || springsExtra){
+            printf("step=%d should match within %g px and spring for spring\n", expected.step, EXACT_ERROR);
+            consistent = false;
+        }
+    }
+    return consistent;
+}
+
+int main(int argc, char * argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++){
+        if (strcmp(argv[i], "--tiles") == 0 && i + 1 < argc)
+            options.tiles = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc)
+            options.steps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc)
+            options.particles = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--springs") == 0 && i + 1 < argc)
+            options.springs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--scaling") == 0)
+            options.scaling = true;
+        else {
+            fprintf(stderr, "usage: %s [--tiles n] [--steps n] [--particles n] [--springs k] [--scaling]\n", argv[0]);
+            return 2;
+        }
+    }
+    options.tiles = ci::math<int>::clamp(options.tiles, 1, 64);
+    options.steps = ci::math<int>::max(options.steps, 1);
+
+    std::vector< Emission > emissions = makeEmissions(options);
+
+    if (options.scaling){
+        double baseline = 0.0;
+        for (int tiles = 1; tiles <= options.tiles; tiles *= 2){
+            RunResult tiled;
+            if (! runTiled(options, emissions, tiles, tiled)){
+                fprintf(stderr, "tiled run with %d tiles failed\n", tiles);
+                return 1;
+            }
+            double stepsPerSecond = tiled.seconds > 0.0 ? options.steps / tiled.seconds : 0.0;
+            if (tiles == 1)
+                baseline = stepsPerSecond;
+            printf("tiles=%d particles=%d steps=%d ghosts=%zu seconds=%.3f steps/s=%.1f speedup=%.2f\n",
+                   tiles, options.particles, options.steps, tiled.ghosts, tiled.seconds, stepsPerSecond,
+                   baseline > 0.0 ? stepsPerSecond / baseline : 0.0);
+        }
+        return 0;
+    }
+
+    // Tiles first, while this process has no threads of its own to fork
+    RunResult tiled;
+    if (! runTiled(options, emissions, options.tiles, tiled)){
+        fprintf(stderr, "tiled run failed\n");
+        return 1;
+    }
+    RunResult single = runSingle(options, emissions);
+
+    bool consistent = compare(single, tiled);
+    printf("tiles=%d particles=%d steps=%d ghosts=%zu single steps/s=%.1f tiled steps/s=%.1f\n",
+           options.tiles, options.particles, options.steps, tiled.ghosts,
+           single.seconds > 0.0 ? options.steps / single.seconds : 0.0,
+           tiled.seconds > 0.0 ? options.steps / tiled.seconds : 0.0);
+    return consistent ? 0 : 1;
+}